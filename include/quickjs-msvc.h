@@ -303,6 +303,9 @@ static inline JS_BOOL JS_VALUE_IS_NAN(JSValue v)
 #define JS_EVAL_FLAG_COMPILE_ONLY (1 << 5)
 /* don't include the stack frames before this eval in the Error() backtraces */
 #define JS_EVAL_FLAG_BACKTRACE_BARRIER (1 << 6)
+/* modules: don't resolve the imports at compile time, use
+   JS_InstantiateModule() later */
+#define JS_EVAL_FLAG_NO_RESOLVE (1 << 7)
 
 typedef JSValue JSCFunction(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv);
 typedef JSValue JSCFunctionMagic(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv, int magic);
@@ -402,6 +405,9 @@ typedef struct JSMemoryUsage {
     int64_t c_func_count, array_count;
     int64_t fast_array_count, fast_array_elements;
     int64_t binary_object_count, binary_object_size;
+    /* ArrayBuffer and SharedArrayBuffer objects, the bytes they hold are
+       also part of memory_used_size */
+    int64_t array_buffer_count, array_buffer_size;
 } JSMemoryUsage;
 
 void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s);
@@ -765,6 +771,38 @@ typedef struct {
 } JSSharedArrayBufferFunctions;
 void JS_SetSharedArrayBufferFunctions(JSRuntime *rt,
                                       const JSSharedArrayBufferFunctions *sf);
+typedef struct {
+    /* 'zeroed' is FALSE when the caller fills the whole buffer itself */
+    void *(*ab_alloc)(void *opaque, size_t size, JS_BOOL zeroed);
+    void (*ab_free)(void *opaque, void *ptr, size_t size);
+    void *ab_opaque;
+} JSArrayBufferFunctions;
+/* who releases the storage handed over by JS_SetArrayBufferFreeFunc() */
+#define JS_ARRAY_BUFFER_STORAGE_NONE      0 /* nobody, owned by the embedder */
+#define JS_ARRAY_BUFFER_STORAGE_MALLOC    1 /* release with free() */
+#define JS_ARRAY_BUFFER_STORAGE_ALLOCATOR 2 /* release with ab_funcs.ab_free() */
+/* element types of the views seen by JS_GetArrayBufferViewData() */
+#define JS_TYPED_ARRAY_UINT8C    0
+#define JS_TYPED_ARRAY_INT8      1
+#define JS_TYPED_ARRAY_UINT8     2
+#define JS_TYPED_ARRAY_INT16     3
+#define JS_TYPED_ARRAY_UINT16    4
+#define JS_TYPED_ARRAY_INT32     5
+#define JS_TYPED_ARRAY_UINT32    6
+#define JS_TYPED_ARRAY_BIGINT64  7
+#define JS_TYPED_ARRAY_BIGUINT64 8
+#define JS_TYPED_ARRAY_FLOAT32   9
+#define JS_TYPED_ARRAY_FLOAT64   10
+#define JS_TYPED_ARRAY_DATAVIEW  11
+/* stack frames captured for an Error, see JS_GetErrorBacktrace() */
+typedef struct JSBacktrace JSBacktrace;
+/* occupancy of one size class of the slab allocator, see JS_GetSlabStats() */
+typedef struct JSSlabClassStats {
+    size_t block_size; /* payload bytes of a block */
+    size_t slab_count;
+    size_t used_count; /* blocks in use */
+    size_t capacity; /* blocks in all the slabs of the class */
+} JSSlabClassStats;
 
 JSValue JS_NewPromiseCapability(JSContext *ctx, JSValue *resolving_funcs);
 
@@ -984,6 +1022,7 @@ JSValue JS_False();
 JSValue JS_Null();
 JSValue JS_Undefined();
 JS_BOOL JS_IsArrayBuffer(JSValueConst obj);
+JS_BOOL JS_IsSharedArrayBuffer(JSValueConst obj);
 JS_BOOL JS_IsArrayBufferView(JSValueConst obj);
 JSValue JS_GetArrayBufferView(JSContext *ctx, JSValueConst obj);
 JS_BOOL JS_GetArrayBufferViewInfo(JSContext *ctx, JSValueConst obj,
@@ -1005,8 +1044,57 @@ JSValue JS_MapDelete(JSContext *ctx, JSValueConst this_val,
                   JSValueConst key);
 
 void JS_MapClear(JSContext *ctx, JSValueConst this_val);
+
+uint32_t JS_GetStringLength(JSValueConst val);
+JS_BOOL JS_IsOneByteString(JSValueConst val);
+const uint8_t *JS_GetStringOneByteData(JSValueConst val);
+JSValue JS_NewOneByteString(JSContext *ctx, const uint8_t *buf, size_t len);
+JSValue JS_NewTwoByteString(JSContext *ctx, const uint16_t *buf, size_t len);
+JSValue JS_InternString(JSContext *ctx, JSValue str);
+JSAtom JS_ValueToAtomFast(JSContext *ctx, JSValueConst val);
+const char *JS_GetStringASCIIData(JSValueConst val);
+void JS_CopyStringUTF16(JSValueConst val, uint16_t *buf, uint32_t start, uint32_t len);
+void JS_CopyStringOneByte(JSValueConst val, uint8_t *buf, uint32_t start, uint32_t len);
+size_t JS_GetStringUtf8Length(JSValueConst val);
+size_t JS_WriteStringUtf8(JSValueConst val, char *buf, size_t capacity,
+                          int *pnchars, JS_BOOL replace_invalid);
+
+int JS_InstantiateModule(JSContext *ctx, JSModuleDef *m);
+JSValue JS_EvaluateModule(JSContext *ctx, JSModuleDef *m);
+int JS_GetModuleStatus(JSModuleDef *m);
+JSValue JS_GetModuleException(JSContext *ctx, JSModuleDef *m);
+int JS_GetModuleRequestsLength(JSModuleDef *m);
+JSAtom JS_GetModuleRequest(JSModuleDef *m, int i);
 JSValue JS_DupModule(JSContext *ctx, JSModuleDef* v);
 
+JSValue JS_NewArrayBufferZeroed(JSContext *ctx, size_t len);
+void JS_SetArrayBufferFunctions(JSRuntime *rt, const JSArrayBufferFunctions *af);
+JSFreeArrayBufferDataFunc *JS_GetArrayBufferFreeFunc(JSValueConst obj, void **popaque);
+int JS_SetArrayBufferFreeFunc(JSContext *ctx, JSValueConst obj,
+                              JSFreeArrayBufferDataFunc *free_func, void *opaque,
+                              JSFreeArrayBufferDataFunc **pold_func, void **pold_opaque);
+int JS_GetArrayBufferViewKind(JSValueConst obj);
+JS_BOOL JS_GetArrayBufferData(JSValueConst obj, uint8_t **pdata, size_t *pbyte_length);
+JS_BOOL JS_GetArrayBufferViewData(JSValueConst obj, uint8_t **pdata, size_t *pbyte_offset,
+                                  size_t *pbyte_length, int *pkind);
+JSValue JS_NewTypedArrayWithBuffer(JSContext *ctx, JSValueConst buffer,
+                                   size_t byte_offset, size_t length, int kind);
+JSBacktrace *JS_CaptureBacktrace(JSContext *ctx, int max_frames);
+JSBacktrace *JS_GetErrorBacktrace(JSRuntime *rt, JSValueConst obj);
+JSBacktrace *JS_DupBacktrace(JSBacktrace *bt);
+void JS_FreeBacktrace(JSRuntime *rt, JSBacktrace *bt);
+int JS_GetBacktraceFrameCount(JSBacktrace *bt);
+JS_BOOL JS_IsBacktraceFrameNative(JSBacktrace *bt, int i);
+JSValue JS_GetBacktraceFrameFunctionName(JSRuntime *rt, JSBacktrace *bt, int i);
+JSValue JS_GetBacktraceFrameScriptName(JSRuntime *rt, JSBacktrace *bt, int i);
+int JS_GetBacktraceFrameLineNumber(JSRuntime *rt, JSBacktrace *bt, int i);
+JSValue JS_GetBacktraceFrameSourceLine(JSContext *ctx, JSBacktrace *bt, int i);
+const JSValue *JS_GetPendingExceptionSlot(JSRuntime *rt);
+void *JS_GetCurrentStackFrame(JSRuntime *rt);
+int JS_GetSlabStats(JSRuntime *rt, JSSlabClassStats *stats, int max_classes);
+void JS_GetMallocState(JSRuntime *rt, JSMallocState *s);
+int JS_GetContextCount(JSRuntime *rt);
+
 /*-------end fuctions for v8 api---------*/
 JSValue JS_GET_MODULE_NS(JSContext *ctx, JSModuleDef* v);
 
@@ -13,6 +13,7 @@
 #include <vector>
 #include <iostream>
 #include <map>
+#include <unordered_map>
 #include <set>
 #include <functional>
 
@@ -32,6 +33,7 @@ namespace v8 {
 class Object;
 class Isolate;
 class Context;
+class Function;
 template <class T>
 class MaybeLocal;
 class Data;
@@ -43,7 +45,11 @@ class FunctionCallbackInfo;
 class String;
 class TryCatch;
 class Script;
+class UnboundScript;
+class Module;
 class Message;
+class StackTrace;
+class StackFrame;
 class Value;
 class Primitive;
 class Boolean;
@@ -296,6 +302,30 @@ public:
     explicit V8_INLINE Local(Script* that) : LocalSharedPtrImpl(that) {}
 };
 
+template <>
+class Local<UnboundScript> : public LocalSharedPtrImpl<UnboundScript> {
+public:
+    V8_INLINE Local() : LocalSharedPtrImpl(){}
+    
+    V8_INLINE Local(const Local<UnboundScript> &that) : LocalSharedPtrImpl(that) { }
+    
+    explicit V8_INLINE Local(UnboundScript* that) : LocalSharedPtrImpl(that) {}
+};
+
+template <>
+class Local<Module> : public LocalSharedPtrImpl<Module> {
+public:
+    V8_INLINE Local() : LocalSharedPtrImpl(){}
+    
+    V8_INLINE Local(const Local<Module> &that) : LocalSharedPtrImpl(that) { }
+    
+    explicit V8_INLINE Local(Module* that) : LocalSharedPtrImpl(that) {}
+    
+    V8_INLINE Local<Module> Clone(Isolate * isolate) const {
+        return *this;
+    }
+};
+
 template <>
 class Local<Data> : public LocalSharedPtrImpl<Data> {
 public:
@@ -357,6 +387,26 @@ public:
     explicit V8_INLINE Local(Message* that) : LocalSharedPtrImpl(that) { }
 };
 
+template <>
+class Local<StackTrace> : public LocalSharedPtrImpl<StackTrace> {
+public:
+    V8_INLINE Local(): LocalSharedPtrImpl(){}
+    
+    V8_INLINE Local(const Local<StackTrace> &that): LocalSharedPtrImpl(that) { }
+
+    explicit V8_INLINE Local(StackTrace* that) : LocalSharedPtrImpl(that) { }
+};
+
+template <>
+class Local<StackFrame> : public LocalSharedPtrImpl<StackFrame> {
+public:
+    V8_INLINE Local(): LocalSharedPtrImpl(){}
+    
+    V8_INLINE Local(const Local<StackFrame> &that): LocalSharedPtrImpl(that) { }
+
+    explicit V8_INLINE Local(StackFrame* that) : LocalSharedPtrImpl(that) { }
+};
+
 template <class T>
 class Maybe {
 public:
@@ -488,6 +538,8 @@ typedef struct ObjectUserData {
     int32_t len_;
     WeakCallback callback_;
     void* parameter_;
+    //创建该对象的FunctionTemplate及其祖先的id链，见FunctionTemplate::TemplateChain
+    const uint32_t* template_chain_;
     void* ptrs_[1];
 } ObjectUserData;
 
@@ -511,8 +563,36 @@ public:
     
     bool IsArrayBuffer() const;
     
+    bool IsSharedArrayBuffer() const;
+    
     bool IsArrayBufferView() const;
     
+    bool IsTypedArray() const;
+    
+    bool IsUint8Array() const;
+    
+    bool IsUint8ClampedArray() const;
+    
+    bool IsInt8Array() const;
+    
+    bool IsUint16Array() const;
+    
+    bool IsInt16Array() const;
+    
+    bool IsUint32Array() const;
+    
+    bool IsInt32Array() const;
+    
+    bool IsFloat32Array() const;
+    
+    bool IsFloat64Array() const;
+    
+    bool IsBigInt64Array() const;
+    
+    bool IsBigUint64Array() const;
+    
+    bool IsDataView() const;
+    
     bool IsDate() const;
 
     bool IsObject() const;
@@ -639,13 +719,28 @@ enum class ArrayBufferCreationMode { kInternalized, kExternalized };
 
 class V8_EXPORT BackingStore {
 public:
+    using DeleterCallback = void (*)(void* data, size_t length, void* deleter_data);
+    
+    ~BackingStore();
+    
     void* Data() const { return data_; }
     
     size_t ByteLength() const { return byte_length_; }
+    
+    bool IsShared() const { return is_shared_; }
+    
+    static void EmptyDeleter(void* data, size_t length, void* deleter_data);
 
-    void* data_;
+    void* data_ = nullptr;
+    
+    size_t byte_length_ = 0;
     
-    size_t byte_length_;
+    //为空表示内存不归BackingStore管
+    DeleterCallback deleter_ = nullptr;
+    
+    void* deleter_data_ = nullptr;
+    
+    bool is_shared_ = false;
 };
 
 class V8_EXPORT ArrayBuffer : public Object {
@@ -653,10 +748,16 @@ public:
     class V8_EXPORT Allocator { // NOLINT
     public:
         virtual ~Allocator() = default;
+        
+        //返回的内存需要清零
+        virtual void* Allocate(size_t length) = 0;
+        
+        //调用方会写满整块内存，不需要清零
+        virtual void* AllocateUninitialized(size_t length) = 0;
+        
+        virtual void Free(void* data, size_t length) = 0;
 
-        V8_INLINE static Allocator* NewDefaultAllocator() {
-            return nullptr;
-        }
+        static Allocator* NewDefaultAllocator();
     };
     
     class V8_EXPORT Contents { // NOLINT
@@ -675,6 +776,14 @@ public:
     static Local<ArrayBuffer> New(Isolate* isolate, void* data, size_t byte_length,
                                   ArrayBufferCreationMode mode = ArrayBufferCreationMode::kExternalized);
     
+    //ArrayBuffer和外部共同持有backing_store，谁最后释放谁触发deleter
+    static Local<ArrayBuffer> New(Isolate* isolate, std::shared_ptr<BackingStore> backing_store);
+    
+    static std::unique_ptr<BackingStore> NewBackingStore(Isolate* isolate, size_t byte_length);
+    
+    static std::unique_ptr<BackingStore> NewBackingStore(void* data, size_t byte_length,
+                                                         BackingStore::DeleterCallback deleter, void* deleter_data);
+    
     Contents GetContents();
 
     std::shared_ptr<BackingStore> GetBackingStore();
@@ -686,17 +795,178 @@ public:
 
 class V8_EXPORT ArrayBufferView : public Object {
 public:
+    //V8没有的扩展：一次拿到视图的数据指针（已加上偏移）、偏移和长度
+    class V8_EXPORT Contents { // NOLINT
+    public:
+        void* Data() const { return data_; }
+        
+        size_t ByteOffset() const { return byte_offset_; }
+        
+        size_t ByteLength() const { return byte_length_; }
+        
+        void* data_ = nullptr;
+        
+        size_t byte_offset_ = 0;
+        
+        size_t byte_length_ = 0;
+    };
+    
     Local<ArrayBuffer> Buffer();
     
     size_t ByteOffset();
     
     size_t ByteLength();
     
+    Contents GetContents();
+    
+    //最多拷贝byte_length字节，返回实际拷贝的字节数
+    size_t CopyContents(void* dest, size_t byte_length);
+    
+    V8_INLINE bool HasBuffer() const { return true; }
+    
     V8_INLINE static ArrayBufferView* Cast(Value* obj) {
         return static_cast<ArrayBufferView*>(obj);
     }
 };
 
+class V8_EXPORT TypedArray : public ArrayBufferView {
+public:
+    //元素个数
+    size_t Length();
+    
+    V8_INLINE static TypedArray* Cast(Value* obj) {
+        return static_cast<TypedArray*>(obj);
+    }
+};
+
+class V8_EXPORT Uint8Array : public TypedArray {
+public:
+    static Local<Uint8Array> New(Local<ArrayBuffer> array_buffer, size_t byte_offset, size_t length);
+    
+    V8_INLINE static Uint8Array* Cast(Value* obj) {
+        return static_cast<Uint8Array*>(obj);
+    }
+};
+
+class V8_EXPORT Uint8ClampedArray : public TypedArray {
+public:
+    static Local<Uint8ClampedArray> New(Local<ArrayBuffer> array_buffer, size_t byte_offset, size_t length);
+    
+    V8_INLINE static Uint8ClampedArray* Cast(Value* obj) {
+        return static_cast<Uint8ClampedArray*>(obj);
+    }
+};
+
+class V8_EXPORT Int8Array : public TypedArray {
+public:
+    static Local<Int8Array> New(Local<ArrayBuffer> array_buffer, size_t byte_offset, size_t length);
+    
+    V8_INLINE static Int8Array* Cast(Value* obj) {
+        return static_cast<Int8Array*>(obj);
+    }
+};
+
+class V8_EXPORT Uint16Array : public TypedArray {
+public:
+    static Local<Uint16Array> New(Local<ArrayBuffer> array_buffer, size_t byte_offset, size_t length);
+    
+    V8_INLINE static Uint16Array* Cast(Value* obj) {
+        return static_cast<Uint16Array*>(obj);
+    }
+};
+
+class V8_EXPORT Int16Array : public TypedArray {
+public:
+    static Local<Int16Array> New(Local<ArrayBuffer> array_buffer, size_t byte_offset, size_t length);
+    
+    V8_INLINE static Int16Array* Cast(Value* obj) {
+        return static_cast<Int16Array*>(obj);
+    }
+};
+
+class V8_EXPORT Uint32Array : public TypedArray {
+public:
+    static Local<Uint32Array> New(Local<ArrayBuffer> array_buffer, size_t byte_offset, size_t length);
+    
+    V8_INLINE static Uint32Array* Cast(Value* obj) {
+        return static_cast<Uint32Array*>(obj);
+    }
+};
+
+class V8_EXPORT Int32Array : public TypedArray {
+public:
+    static Local<Int32Array> New(Local<ArrayBuffer> array_buffer, size_t byte_offset, size_t length);
+    
+    V8_INLINE static Int32Array* Cast(Value* obj) {
+        return static_cast<Int32Array*>(obj);
+    }
+};
+
+class V8_EXPORT Float32Array : public TypedArray {
+public:
+    static Local<Float32Array> New(Local<ArrayBuffer> array_buffer, size_t byte_offset, size_t length);
+    
+    V8_INLINE static Float32Array* Cast(Value* obj) {
+        return static_cast<Float32Array*>(obj);
+    }
+};
+
+class V8_EXPORT Float64Array : public TypedArray {
+public:
+    static Local<Float64Array> New(Local<ArrayBuffer> array_buffer, size_t byte_offset, size_t length);
+    
+    V8_INLINE static Float64Array* Cast(Value* obj) {
+        return static_cast<Float64Array*>(obj);
+    }
+};
+
+class V8_EXPORT BigInt64Array : public TypedArray {
+public:
+    static Local<BigInt64Array> New(Local<ArrayBuffer> array_buffer, size_t byte_offset, size_t length);
+    
+    V8_INLINE static BigInt64Array* Cast(Value* obj) {
+        return static_cast<BigInt64Array*>(obj);
+    }
+};
+
+class V8_EXPORT BigUint64Array : public TypedArray {
+public:
+    static Local<BigUint64Array> New(Local<ArrayBuffer> array_buffer, size_t byte_offset, size_t length);
+    
+    V8_INLINE static BigUint64Array* Cast(Value* obj) {
+        return static_cast<BigUint64Array*>(obj);
+    }
+};
+
+class V8_EXPORT DataView : public ArrayBufferView {
+public:
+    V8_INLINE static DataView* Cast(Value* obj) {
+        return static_cast<DataView*>(obj);
+    }
+};
+
+//同一块内存可以在多个isolate（线程）里各建一个SharedArrayBuffer
+class V8_EXPORT SharedArrayBuffer : public Object {
+public:
+    static Local<SharedArrayBuffer> New(Isolate* isolate, size_t byte_length);
+    
+    //backing_store可以来自另一个isolate的SharedArrayBuffer::GetBackingStore
+    static Local<SharedArrayBuffer> New(Isolate* isolate, std::shared_ptr<BackingStore> backing_store);
+    
+    static std::unique_ptr<BackingStore> NewBackingStore(Isolate* isolate, size_t byte_length);
+    
+    static std::unique_ptr<BackingStore> NewBackingStore(void* data, size_t byte_length,
+                                                         BackingStore::DeleterCallback deleter, void* deleter_data);
+    
+    size_t ByteLength();
+    
+    std::shared_ptr<BackingStore> GetBackingStore();
+    
+    V8_INLINE static SharedArrayBuffer* Cast(Value* obj) {
+        return static_cast<SharedArrayBuffer*>(obj);
+    }
+};
+
 class V8_EXPORT Promise : public Object {
 public:
     V8_INLINE static Promise* Cast(Value* obj) {
@@ -739,25 +1009,129 @@ private:
 
 typedef void (*PromiseRejectCallback)(PromiseRejectMessage message);
 
+typedef void (*MicrotaskCallback)(void* data);
+
+//kExplicit：只在PerformMicrotaskCheckpoint时执行
+//kScoped：最外层的MicrotasksScope(kRunMicrotasks)退出时执行
+//kAuto：和原来一样，退出Context::Scope时执行
+enum class MicrotasksPolicy { kExplicit, kScoped, kAuto };
+
+typedef void (*AccessorNameGetterCallback)(Local<Name> property, const PropertyCallbackInfo<Value>& info);
+
+
+typedef void (*AccessorNameSetterCallback)(Local<Name> property, Local<Value> value,
+                                           const PropertyCallbackInfo<void>& info);
+
+//计数器模式，直接读quickjs runtime的分配计数，不遍历堆，可以频繁调用
+class V8_EXPORT HeapStatistics {
+public:
+    HeapStatistics();
+    
+    size_t total_heap_size() { return total_heap_size_; }
+    size_t total_heap_size_executable() { return total_heap_size_executable_; }
+    size_t total_physical_size() { return total_physical_size_; }
+    size_t total_available_size() { return total_available_size_; }
+    size_t total_global_handles_size() { return total_global_handles_size_; }
+    size_t used_global_handles_size() { return used_global_handles_size_; }
+    size_t used_heap_size() { return used_heap_size_; }
+    size_t heap_size_limit() { return heap_size_limit_; }
+    size_t malloced_memory() { return malloced_memory_; }
+    size_t external_memory() { return external_memory_; }
+    size_t peak_malloced_memory() { return peak_malloced_memory_; }
+    size_t number_of_native_contexts() { return number_of_native_contexts_; }
+    size_t number_of_detached_contexts() { return number_of_detached_contexts_; }
+    size_t does_zap_garbage() { return does_zap_garbage_; }
+    
+    size_t total_heap_size_;
+    size_t total_heap_size_executable_;
+    size_t total_physical_size_;
+    size_t total_available_size_;
+    size_t total_global_handles_size_;
+    size_t used_global_handles_size_;
+    size_t used_heap_size_;
+    size_t heap_size_limit_;
+    size_t malloced_memory_;
+    size_t external_memory_;
+    size_t peak_malloced_memory_;
+    size_t number_of_native_contexts_;
+    size_t number_of_detached_contexts_;
+    size_t does_zap_garbage_;
+};
+
+//quickjs没有分代和空间，按JS_ComputeMemoryUsage的分类映射成space
+class V8_EXPORT HeapSpaceStatistics {
+public:
+    HeapSpaceStatistics();
+    
+    const char* space_name() { return space_name_; }
+    size_t space_size() { return space_size_; }
+    size_t space_used_size() { return space_used_size_; }
+    size_t space_available_size() { return space_available_size_; }
+    size_t physical_space_size() { return physical_space_size_; }
+    
+    const char* space_name_;
+    size_t space_size_;
+    size_t space_used_size_;
+    size_t space_available_size_;
+    size_t physical_space_size_;
+};
+
+class V8_EXPORT HeapObjectStatistics {
+public:
+    HeapObjectStatistics();
+    
+    const char* object_type() { return object_type_; }
+    const char* object_sub_type() { return object_sub_type_; }
+    size_t object_count() { return object_count_; }
+    size_t object_size() { return object_size_; }
+    
+    const char* object_type_;
+    const char* object_sub_type_;
+    size_t object_count_;
+    size_t object_size_;
+};
+
 class V8_EXPORT Isolate {
 public:
-    static Isolate* current_;
+    //每个线程各自的当前isolate，一个线程一个isolate时互不干扰
+    V8_INLINE static Isolate* GetCurrent() {
+        return CurrentSlot();
+    }
+    
+#if defined(V8_OS_WIN) && (defined(BUILDING_V8_SHARED) || defined(USING_V8_SHARED))
+    //MSVC不允许dll导出thread_local数据（inline函数里的static也算），只能放在函数后面
+    static Isolate*& CurrentSlot();
+#else
+    //函数内的thread_local是常量初始化，不需要初始化检查，访问就是一次TLS读写
+    V8_INLINE static Isolate*& CurrentSlot() {
+        static thread_local Isolate* current = nullptr;
+        return current;
+    }
+#endif
     
     struct CreateParams {
         CreateParams()
-            : array_buffer_allocator(nullptr) {}
+            : array_buffer_allocator(nullptr), malloc_functions(nullptr), malloc_opaque(nullptr) {}
         ArrayBuffer::Allocator* array_buffer_allocator;
+        
+        //非空时quickjs runtime的所有内存（对象、字符串、shape等）都走这组函数，通过JS_NewRuntime2传入，
+        //需要保证在Isolate销毁前有效。js_malloc/js_free/js_realloc要自己维护JSMallocState的
+        //malloc_count和malloc_size，gc的触发和内存统计依赖它们；js_malloc_usable_size可以为空
+        const JSMallocFunctions* malloc_functions;
+        
+        //JSMallocState::opaque
+        void* malloc_opaque;
     };
 
     class V8_EXPORT Scope {
     public:
         explicit V8_INLINE Scope(Isolate* isolate) {
-            prev_isolate_ = current_;
-            current_ = isolate;
+            prev_isolate_ = CurrentSlot();
+            CurrentSlot() = isolate;
         }
 
         V8_INLINE ~Scope() {
-            current_ = prev_isolate_;
+            CurrentSlot() = prev_isolate_;
         }
 
         // Prevent copying of Scope objects.
@@ -769,7 +1143,7 @@ public:
     };
 
     V8_INLINE static Isolate* New(const CreateParams& params) {
-        return new Isolate();
+        return new Isolate(params);
     }
     
     V8_INLINE static Isolate* New(void* external_context) {
@@ -786,10 +1160,44 @@ public:
     
     void LowMemoryNotification();
     
+    //只读计数器，不遍历堆
+    void GetHeapStatistics(HeapStatistics* heap_statistics);
+    
+    size_t NumberOfHeapSpaces();
+    
+    //index为0时重新遍历堆（JS_ComputeMemoryUsage）取快照，其它index读同一个快照，
+    //所以按0..NumberOfHeapSpaces()-1的顺序遍历即可拿到一致的数据
+    bool GetHeapSpaceStatistics(HeapSpaceStatistics* space_statistics, size_t index);
+    
+    size_t NumberOfTrackedHeapObjectTypes();
+    
+    //同GetHeapSpaceStatistics，type_index为0时刷新快照。quickjs不保留GC时的数据，
+    //所以返回的是调用时的快照，而不是上一次GC时的
+    bool GetHeapObjectStatisticsAtLastGC(HeapObjectStatistics* object_statistics, size_t type_index);
+    
     Local<Value> ThrowException(Local<Value> exception);
     
     void SetPromiseRejectCallback(PromiseRejectCallback callback);
     
+    void PerformMicrotaskCheckpoint();
+    
+    void EnqueueMicrotask(Local<Function> microtask);
+    
+    void EnqueueMicrotask(MicrotaskCallback callback, void* data = nullptr);
+    
+    V8_INLINE void SetMicrotasksPolicy(MicrotasksPolicy policy) { microtasks_policy_ = policy; }
+    
+    V8_INLINE MicrotasksPolicy GetMicrotasksPolicy() const { return microtasks_policy_; }
+    
+    //V8没有的扩展：限制每次checkpoint执行的微任务个数和耗时（毫秒），0表示不限制，
+    //超出部分留到下一次checkpoint，用于按帧驱动的宿主控制每帧的延迟
+    V8_INLINE void SetMicrotasksBudget(size_t max_count, double max_milliseconds) {
+        microtasks_max_count_ = max_count;
+        microtasks_max_milliseconds_ = max_milliseconds;
+    }
+    
+    bool HasPendingMicrotasks();
+    
     void handleException();
 
     JSRuntime *runtime_;
@@ -797,29 +1205,86 @@ public:
     bool is_external_runtime_;
     
     JSClassID class_id_;
+    
+    JSClassID function_data_class_id_;
+    
+    JSClassID accessor_data_class_id_;
 
     Local<Context> current_context_;
 
     Isolate();
     
     Isolate(void* external_context);
+    
+    Isolate(const CreateParams& params);
+    
+    Isolate(JSRuntime* runtime, bool is_external_runtime);
 
     ~Isolate();
     
+    //非空时ArrayBuffer的数据内存都走这个分配器，不占用js堆
+    ArrayBuffer::Allocator* array_buffer_allocator_ = nullptr;
+    
+    //通过array_buffer_allocator_分配且还未释放的字节数
+    size_t array_buffer_allocated_bytes_ = 0;
+    
+    //GetHeapSpaceStatistics、GetHeapObjectStatisticsAtLastGC共用的快照
+    void UpdateHeapSnapshot();
+    
+    bool heap_snapshot_valid_ = false;
+    
+    JSMemoryUsage heap_snapshot_;
+    
     TryCatch *currentTryCatch_ = nullptr;
     
-    std::vector<JSValue*> values_;
+    MicrotasksPolicy microtasks_policy_ = MicrotasksPolicy::kAuto;
+    
+    size_t microtasks_max_count_ = 0;
+    
+    double microtasks_max_milliseconds_ = 0;
+    
+    //MicrotasksScope嵌套深度
+    int microtasks_depth_ = 0;
+    
+    bool running_microtasks_ = false;
+    
+    //handle按块分配，块地址固定，Local<T>持有的指针在块释放前一直有效
+    static const int kHandleBlockSize = 256;
+    
+    std::vector<JSValue*> handle_blocks_;
+    
+    JSValue* handle_next_ = nullptr;
+    
+    JSValue* handle_limit_ = nullptr;
     
     JSValue literal_values_[kEmptyStringIndex + 1];
     
     int value_alloc_pos_ = 0;
     
-    JSValue exception_;
+    //指向quickjs的当前异常，没有异常时为JS_UNINITIALIZED（js可以throw null/undefined）
+    const JSValue* pending_exception_ = nullptr;
+    
+    V8_INLINE bool HasPendingException() const {
+        return !JS_IsUninitialized(*pending_exception_);
+    }
     
     HandleScope *currentHandleScope = nullptr;
     
     void *embedder_data_ = nullptr;
     
+    uint32_t next_template_id_ = 0;
+    
+    //FunctionTemplate::TemplateChain分配的id链，对象里会引用，所以随Isolate一起释放
+    std::vector<uint32_t*> template_chains_;
+    
+    //还持有runtime里的值的Message、StackTrace、StackFrame，它们可能比Isolate活得久，
+    //Isolate销毁前通知它们放开引用
+    std::vector<Message*> messages_;
+    
+    std::vector<StackTrace*> stack_traces_;
+    
+    std::vector<StackFrame*> stack_frames_;
+    
     V8_INLINE void* GetData(uint32_t slot) {
         V8::Check(slot == 0, "not supported yet");
         return embedder_data_;
@@ -834,13 +1299,39 @@ public:
         return static_cast<F*>(Alloc_());
     }
     
-    Value* Alloc_();
+    V8_INLINE Value* Alloc_() {
+        if (V8_UNLIKELY(handle_next_ == handle_limit_)) {
+            NextHandleBlock_();
+        }
+        ++value_alloc_pos_;
+        return reinterpret_cast<Value*>(handle_next_++);
+    }
+    
+    void NextHandleBlock_();
     
     V8_INLINE int GetAllocPos() {
         return value_alloc_pos_;
     }
     
-    void ForeachAllocValue(int start, int end, std::function<void(JSValue*, int)>);
+    void SetAllocPos(int pos);
+    
+    //释放[start, value_alloc_pos_)的handle，逐块从后往前扫，只对有引用计数的值调用JS_FreeValueRT
+    V8_INLINE void FreeHandles(int start) {
+        int end = value_alloc_pos_;
+        while (end > start) {
+            int block_start = (end - 1) / kHandleBlockSize * kHandleBlockSize;
+            int from = block_start > start ? block_start : start;
+            JSValue* first = handle_blocks_[block_start / kHandleBlockSize] + (from - block_start);
+            for (JSValue* val = first + (end - from); val != first;) {
+                --val;
+                if (JS_VALUE_HAS_REF_COUNT(*val)) {
+                    JS_FreeValueRT(runtime_, *val);
+                }
+            }
+            end = from;
+        }
+        SetAllocPos(start);
+    }
     
     V8_INLINE void Escape(Value* val) {
         Escape(reinterpret_cast<JSValue*>(val));
@@ -907,9 +1398,8 @@ public:
         }
         V8_INLINE ~Scope() {
             if (enter_new_) {
-                while (JS_IsJobPending(isolate_->runtime_)) {
-                    JSContext *ctx = nullptr;
-                    JS_ExecutePendingJob(isolate_->runtime_, &ctx);
+                if (isolate_->microtasks_policy_ == MicrotasksPolicy::kAuto) {
+                    isolate_->PerformMicrotaskCheckpoint();
                 }
                 isolate_->current_context_ = prev_context_;
             }
@@ -930,6 +1420,24 @@ public:
     JSValue global_;
     
     bool is_external_context_;
+    
+    //在本Context缓存过函数的FunctionTemplate，Context析构时通知它们清理
+    std::vector<FunctionTemplate*> function_templates_;
+    
+    //字节码绑定在本Context的UnboundScript，Context析构时让它们放开JSContext
+    std::vector<UnboundScript*> unbound_scripts_;
+    
+    //本Context编译的模块
+    std::vector<Local<Module>> modules_;
+    
+    //模块名（resource name） -> modules_下标，和quickjs一样同名时以先编译的为准
+    std::unordered_map<std::string, size_t> module_names_;
+    
+    //模块解析缓存，key为引用方模块名 + '\0' + specifier，value为解析到的模块名
+    std::unordered_map<std::string, std::string> resolved_modules_;
+    
+    //最近一次InstantiateModule传入的回调，动态import()也通过它解析
+    MaybeLocal<Module> (*resolve_module_callback_)(Local<Context> context, Local<String> specifier, Local<Module> referrer) = nullptr;
 
     Context(Isolate* isolate, void* external_context);
     
@@ -962,7 +1470,7 @@ class WeakCallbackInfo {
 public:
     typedef void (*Callback)(const WeakCallbackInfo<T>& data);
     
-    V8_INLINE Isolate* GetIsolate() const { return Isolate::current_;}
+    V8_INLINE Isolate* GetIsolate() const { return Isolate::GetCurrent();}
     
     V8_INLINE T* GetParameter() const { return reinterpret_cast<T*>(object_udata_.parameter_); }
     
@@ -1182,9 +1690,39 @@ enum class NewStringType {
 
 class V8_EXPORT String : public Name {
 public:
+    enum WriteOptions {
+        NO_OPTIONS = 0,
+        HINT_MANY_WRITES_EXPECTED = 1,
+        NO_NULL_TERMINATION = 2,
+        PRESERVE_ONE_BYTE_NULL = 4,
+        REPLACE_INVALID_UTF8 = 8
+    };
+    
+    int Length() const;
+    
+    //quickjs以Latin-1（8bit）存储
+    bool IsOneByte() const;
+    
+    //单字节存储时直接返回内部buffer（以'\0'结尾，Latin-1编码，不一定是ASCII），不拷贝，
+    //在该字符串被持有（比如Local<String>所在HandleScope存活）期间有效；否则返回nullptr
+    const uint8_t* GetOneByteView(int* length = nullptr) const;
+    
     int Utf8Length(Isolate* isolate) const;
+    
+    //同V8：从start开始写length个字符（-1为到结尾），空间足够时补'\0'，返回值不包含'\0'
+    int Write(Isolate* isolate, uint16_t* buffer, int start = 0, int length = -1,
+              int options = NO_OPTIONS) const;
+    
+    //16bit字符会被截断为低8位
+    int WriteOneByte(Isolate* isolate, uint8_t* buffer, int start = 0,
+                     int length = -1, int options = NO_OPTIONS) const;
 
+    //写入完整的utf8，不带'\0'，返回写入的字节数，buffer至少要Utf8Length大小
     int WriteUtf8(Isolate* isolate, char* buffer) const;
+    
+    //同V8：最多写capacity字节（-1为不限），不会截断字符，返回值包含写入的'\0'
+    int WriteUtf8(Isolate* isolate, char* buffer, int capacity,
+                  int* nchars_ref = nullptr, int options = NO_OPTIONS) const;
 
     static Local<String> Empty(Isolate* isolate);
 
@@ -1194,6 +1732,12 @@ public:
 
     static V8_WARN_UNUSED_RESULT MaybeLocal<String> NewFromUtf8(
         Isolate* isolate, const char* data, NewStringType type = NewStringType::kNormal, int length = -1);
+    
+    static V8_WARN_UNUSED_RESULT MaybeLocal<String> NewFromOneByte(
+        Isolate* isolate, const uint8_t* data, NewStringType type = NewStringType::kNormal, int length = -1);
+    
+    static V8_WARN_UNUSED_RESULT MaybeLocal<String> NewFromTwoByte(
+        Isolate* isolate, const uint16_t* data, NewStringType type = NewStringType::kNormal, int length = -1);
 
 
     class V8_EXPORT Utf8Value {
@@ -1214,6 +1758,28 @@ public:
         const char* data_;
         size_t len_;
         JSContext *context_ = nullptr;
+        //短字符串直接编码到这里，不用分配
+        char inline_buffer_[64];
+    };
+    
+    //UTF-16拷贝
+    class V8_EXPORT Value {
+    public:
+        Value(Isolate* isolate, Local<v8::Value> obj);
+        
+        ~Value();
+        
+        uint16_t* operator*() { return str_; }
+        const uint16_t* operator*() const { return str_; }
+        int length() const { return length_; }
+        
+        // Disallow copying and assigning.
+        Value(const Value&) = delete;
+        void operator=(const Value&) = delete;
+        
+    private:
+        uint16_t* str_;
+        int length_;
     };
 
 private:
@@ -1260,18 +1826,38 @@ public:
                              Local<FunctionTemplate> setter = Local<FunctionTemplate>(),
                              PropertyAttribute attribute = None);
     
-    std::map<std::string, Local<Data>> fields_;
+    //属性名在第一次InitPropertys时转成JSAtom，之后所有Context复用，Template析构时释放
+    struct FieldInfo {
+        std::string name_;
+        JSAtom atom_;
+        Local<Data> value_;
+    };
+    
+    std::vector<FieldInfo> fields_;
+    
+    //属性多时才建立，name -> fields_的下标
+    std::unordered_map<std::string, size_t> fields_index_;
     
     class AccessorPropertyInfo {
     public:
+        std::string name_;
+        JSAtom atom_;
         Local<FunctionTemplate> getter_;
         Local<FunctionTemplate> setter_;
         PropertyAttribute attribute_;
     };
     
-    std::map<std::string, AccessorPropertyInfo> accessor_property_infos_;
+    std::vector<AccessorPropertyInfo> accessor_property_infos_;
+    
+    std::unordered_map<std::string, size_t> accessor_property_index_;
     
     void InitPropertys(Local<Context> context, JSValue obj);
+    
+    JSAtom InternAtom(JSContext* ctx, const std::string& name, JSAtom& atom);
+    
+    JSRuntime* atom_runtime_ = nullptr;
+    
+    ~Template();
 };
 
 enum AccessControl {
@@ -1281,12 +1867,6 @@ enum AccessControl {
   PROHIBITS_OVERWRITING = 1 << 2
 };
 
-typedef void (*AccessorNameGetterCallback)(Local<Name> property, const PropertyCallbackInfo<Value>& info);
-
-
-typedef void (*AccessorNameSetterCallback)(Local<Name> property, Local<Value> value,
-                                           const PropertyCallbackInfo<void>& info);
-
 class V8_EXPORT ObjectTemplate : public Template {
 public:
     void SetInternalFieldCount(int value);
@@ -1300,15 +1880,34 @@ public:
     
     void InitAccessors(Local<Context> context, JSValue obj);
     
-    struct AccessorInfo {
+    //getter/setter闭包共享的数据，放在一个accessor_data_class_id_的对象里，随最后一个引用它的闭包（或模板）释放
+    struct AccessorData {
         AccessorNameGetterCallback getter_;
         AccessorNameSetterCallback setter_;
         JSValue data_;
+        JSValue name_;
+    };
+    
+    struct AccessorInfo {
+        std::string name_;
+        JSAtom atom_;
+        AccessorNameGetterCallback getter_;
+        AccessorNameSetterCallback setter_;
+        //模板持有一个引用，重新SetAccessor或模板析构时释放
+        JSValue data_ = JS_Undefined();
         AccessControl settings_;
         PropertyAttribute attribute_;
+        //第一次InitAccessors时创建的AccessorData对象，之后所有Context复用
+        JSValue holder_ = JS_Undefined();
     };
     
-    std::map<std::string, AccessorInfo> accessor_infos_;
+    std::vector<AccessorInfo> accessor_infos_;
+    
+    std::unordered_map<std::string, size_t> accessor_index_;
+    
+    JSRuntime* accessor_runtime_ = nullptr;
+    
+    ~ObjectTemplate();
 };
 
 typedef void (*FunctionCallback)(const FunctionCallbackInfo<Value>& info);
@@ -1320,6 +1919,7 @@ public:
         FunctionCallback callback_;
         int internal_field_count_;
         bool is_construtor_;
+        const uint32_t* template_chain_;
     };
     
     static Local<FunctionTemplate> New(
@@ -1349,7 +1949,23 @@ public:
     Local<ObjectTemplate> prototype_template_;
     Local<FunctionTemplate> parent_;
     
-    std::map<Context*, JSValue> context_to_funtion_;
+    //template_id_从1开始，chain[0]是链长度，chain[1..]从根模板到自身依次是各级模板的id
+    uint32_t template_id_;
+    
+    uint32_t template_depth_ = 0;
+    
+    const uint32_t* template_chain_ = nullptr;
+    
+    const uint32_t* TemplateChain();
+    
+    std::unordered_map<Context*, JSValue> context_to_funtion_;
+    
+    //绝大多数情况只有一个Context，先比较上次命中的
+    Context* last_context_ = nullptr;
+    
+    JSValue last_function_;
+    
+    void ForgetContext(Context* context);
     
     ~FunctionTemplate();
 };
@@ -1537,35 +2153,270 @@ V8_INLINE Value *EscapeValue_(Value* val, EscapableHandleScope* scope) {
     return reinterpret_cast<Value*>(&scope->prev_scope_->scope_value_);
 }
 
+class V8_EXPORT UnboundScript : Data {
+public:
+    ~UnboundScript();
+private:
+    friend class Script;
+    friend class ScriptCompiler;
+    friend class Context;
+    
+    //把字节码换到另一个Context：quickjs的字节码绑定了realm（JSContext），只能序列化后在新的Context里重新加载。
+    //context为nullptr时只保存序列化结果，不再引用任何JSContext
+    bool BindTo(Context* context);
+    
+    //编译后的字节码（JS_TAG_FUNCTION_BYTECODE），realm为context_，Compile时生成，Run只负责执行
+    JSValue function_bytecode_;
+    //字节码所属的Context，该Context析构时改为保存序列化结果并置空，避免Script让JSContext一直存活
+    Context* context_;
+    //context_为空时的字节码（JS_WriteObject格式）
+    std::vector<uint8_t> detached_bytecode_;
+    JSRuntime* runtime_;
+    //用于code cache的校验
+    uint32_t source_length_;
+};
+
 class V8_EXPORT Script : Data {
 public:
+    //会在这里完成解析，语法错误在Compile时就报告
     static V8_WARN_UNUSED_RESULT MaybeLocal<Script> Compile(
         Local<Context> context, Local<String> source,
         ScriptOrigin* origin = nullptr);
 
     V8_WARN_UNUSED_RESULT MaybeLocal<Value> Run(Local<Context> context);
     
-    ~Script();
+    V8_INLINE Local<UnboundScript> GetUnboundScript() {
+        return unbound_script_;
+    }
+    
 private:
-    Local<String> source_;
-    MaybeLocal<String> resource_name_;
+    friend class ScriptCompiler;
+    
+    static Local<Script> New_(Context* context, JSValue bytecode, uint32_t source_length);
+    
+    Local<UnboundScript> unbound_script_;
 };
 
-class V8_EXPORT Message : Data {
+class V8_EXPORT Module : Data {
+public:
+    enum Status {
+        kUninstantiated,
+        kInstantiating,
+        kInstantiated,
+        kEvaluating,
+        kEvaluated,
+        kErrored
+    };
+    
+    Status GetStatus() const;
+    
+    Local<Value> GetException() const;
+    
+    int GetModuleRequestsLength() const;
+    
+    Local<String> GetModuleRequest(int i) const;
+    
+    int GetIdentityHash() const;
+    
+    typedef MaybeLocal<Module> (*ResolveCallback)(Local<Context> context,
+                                                  Local<String> specifier,
+                                                  Local<Module> referrer);
+    
+    //每个(referrer, specifier)只会回调一次，结果缓存在Context里
+    V8_WARN_UNUSED_RESULT Maybe<bool> InstantiateModule(Local<Context> context,
+                                                        ResolveCallback callback);
+    
+    V8_WARN_UNUSED_RESULT MaybeLocal<Value> Evaluate(Local<Context> context);
+    
+    //所在的Context析构后返回undefined
+    Local<Value> GetModuleNamespace();
+    
+    //模块本身由quickjs的JSContext管理，这里持有一个引用，Context析构时置空
+    JSModuleDef* module_ = nullptr;
+    
+    JSContext* context_ = nullptr;
+};
+
+class V8_EXPORT ScriptCompiler {
 public:
-    V8_INLINE Local<Value> GetScriptResourceName() const {
-        return String::NewFromUtf8(Isolate::current_, resource_name_.data(), NewStringType::kNormal, resource_name_.length()).ToLocalChecked();
+    struct CachedData {
+        enum BufferPolicy {
+            BufferNotOwned,
+            BufferOwned
+        };
+        
+        V8_INLINE CachedData()
+            : data(nullptr), length(0), rejected(false), buffer_policy(BufferNotOwned) {}
+        
+        V8_INLINE CachedData(const uint8_t* data, int length,
+                   BufferPolicy buffer_policy = BufferNotOwned)
+            : data(data), length(length), rejected(false), buffer_policy(buffer_policy) {}
+        
+        V8_INLINE ~CachedData() {
+            if (buffer_policy == BufferOwned) {
+                delete[] data;
+            }
+        }
+        
+        const uint8_t* data;
+        int length;
+        bool rejected;
+        BufferPolicy buffer_policy;
+        
+        CachedData(const CachedData&) = delete;
+        CachedData& operator=(const CachedData&) = delete;
+    };
+    
+    class Source {
+    public:
+        //cached_data的所有权转移给Source
+        V8_INLINE Source(Local<String> source_string, const ScriptOrigin& origin,
+                         CachedData* cached_data = nullptr)
+            : source_string_(source_string), resource_name_(origin.ResourceName()), cached_data_(cached_data) {}
+        
+        V8_INLINE Source(Local<String> source_string, CachedData* cached_data = nullptr)
+            : source_string_(source_string), cached_data_(cached_data) {}
+        
+        V8_INLINE ~Source() {
+            delete cached_data_;
+        }
+        
+        V8_INLINE const CachedData* GetCachedData() const {
+            return cached_data_;
+        }
+        
+        Source(const Source&) = delete;
+        Source& operator=(const Source&) = delete;
+        
+    private:
+        friend class ScriptCompiler;
+        
+        Local<String> source_string_;
+        Local<Value> resource_name_;
+        CachedData* cached_data_;
+    };
+    
+    enum CompileOptions {
+        kNoCompileOptions = 0,
+        kConsumeCodeCache,
+        kEagerCompile
+    };
+    
+    //kConsumeCodeCache时如果cache和源码不匹配（或者版本不对），会设置cached_data->rejected，并回退到编译源码
+    //Script::Compile已经是eager的，kEagerCompile和kNoCompileOptions行为一致
+    static V8_WARN_UNUSED_RESULT MaybeLocal<Script> Compile(
+        Local<Context> context, Source* source,
+        CompileOptions options = kNoCompileOptions);
+    
+    //Source的resource name作为模块名
+    static V8_WARN_UNUSED_RESULT MaybeLocal<Module> CompileModule(
+        Isolate* isolate, Source* source,
+        CompileOptions options = kNoCompileOptions);
+    
+    //返回的CachedData由调用者delete
+    static CachedData* CreateCodeCache(Local<UnboundScript> unbound_script);
+};
+
+class V8_EXPORT StackFrame : Data {
+public:
+    StackFrame(Isolate* isolate, JSBacktrace* backtrace, int index);
+    
+    ~StackFrame();
+    
+    int GetLineNumber() const;
+    
+    //quickjs不记录列号
+    V8_INLINE int GetColumn() const {
+        return 0;
     }
     
-    //TODO: quickjs未提供该信息?
-    V8_INLINE V8_WARN_UNUSED_RESULT Maybe<int> GetLineNumber(Local<Context> context) const {
-        return Maybe<int>(line_number_);
+    V8_INLINE int GetScriptId() const {
+        return 0;
+    }
+    
+    Local<String> GetScriptName() const;
+    
+    V8_INLINE Local<String> GetScriptNameOrSourceURL() const {
+        return GetScriptName();
+    }
+    
+    Local<String> GetFunctionName() const;
+    
+    V8_INLINE bool IsEval() const {
+        return false;
+    }
+    
+    V8_INLINE bool IsConstructor() const {
+        return false;
     }
     
-    V8_INLINE V8_WARN_UNUSED_RESULT MaybeLocal<String> GetSourceLine(Local<Context> context) const {
-        return String::Empty(context->GetIsolate());
+    V8_INLINE bool IsWasm() const {
+        return false;
     }
     
+    bool IsUserJavaScript() const;
+    
+    //释放backtrace_，之后各个接口返回-1或者空。析构或者Isolate销毁时调用
+    void Detach();
+    
+    //Detach后为nullptr
+    Isolate* isolate_;
+    
+    //和StackTrace共享，字符串在读取时才生成
+    JSBacktrace* backtrace_;
+    
+    int index_;
+};
+
+class V8_EXPORT StackTrace : Data {
+public:
+    enum StackTraceOptions {
+        kLineNumber = 1,
+        kColumnOffset = 1 << 1 | kLineNumber,
+        kScriptName = 1 << 2,
+        kFunctionName = 1 << 3,
+        kIsEval = 1 << 4,
+        kIsConstructor = 1 << 5,
+        kScriptNameOrSourceURL = 1 << 6,
+        kScriptId = 1 << 7,
+        kExposeFramesAcrossSecurityOrigins = 1 << 8,
+        kOverview = kLineNumber | kColumnOffset | kScriptName | kFunctionName,
+        kDetailed = kOverview | kIsEval | kIsConstructor | kScriptNameOrSourceURL
+    };
+    
+    StackTrace(Isolate* isolate, JSBacktrace* backtrace);
+    
+    ~StackTrace();
+    
+    Local<StackFrame> GetFrame(Isolate* isolate, uint32_t index) const;
+    
+    int GetFrameCount() const;
+    
+    //只记录函数及pc，options不影响采集的开销
+    static Local<StackTrace> CurrentStackTrace(Isolate* isolate, int frame_limit,
+                                               StackTraceOptions options = kDetailed);
+    
+    //同StackFrame::Detach
+    void Detach();
+    
+    Isolate* isolate_;
+    
+    JSBacktrace* backtrace_;
+};
+
+class V8_EXPORT Message : Data {
+public:
+    Message(Isolate* isolate, JSValueConst exception);
+    
+    ~Message();
+    
+    Local<Value> GetScriptResourceName() const;
+    
+    V8_WARN_UNUSED_RESULT Maybe<int> GetLineNumber(Local<Context> context) const;
+    
+    V8_WARN_UNUSED_RESULT MaybeLocal<String> GetSourceLine(Local<Context> context) const;
+    
+    //quickjs不记录列号，固定返回0
     V8_INLINE int GetStartColumn() const {
         return 0;
     }
@@ -1574,10 +2425,54 @@ public:
         return 0;
     }
     
+    Local<StackTrace> GetStackTrace() const;
+    
+    //首次读取位置信息时才计算
+    void Resolve() const;
     
-    std::string resource_name_;
+    //先算好行号再释放持有的值和栈帧，之后只能读行号。析构或者Isolate销毁时调用
+    void Detach();
     
-    int line_number_ = 0;
+    //Detach后为nullptr
+    Isolate* isolate_;
+    
+    JSValue exception_;
+    
+    //抛出时的栈帧，js读过stack之后也还在
+    JSBacktrace* backtrace_;
+    
+    mutable bool resolved_ = false;
+    
+    mutable JSValue resource_name_;
+    
+    mutable int line_number_ = -1;
+    
+    //resource_name_对应的栈帧，-1表示来自fileName属性或者未知
+    mutable int frame_index_ = -1;
+};
+
+class V8_EXPORT MicrotasksScope {
+public:
+    enum Type { kRunMicrotasks, kDoNotRunMicrotasks };
+    
+    MicrotasksScope(Isolate* isolate, Type type);
+    
+    ~MicrotasksScope();
+    
+    static void PerformCheckpoint(Isolate* isolate);
+    
+    static int GetCurrentDepth(Isolate* isolate);
+    
+    static bool IsRunningMicrotasks(Isolate* isolate);
+    
+    // Prevent copying.
+    MicrotasksScope(const MicrotasksScope&) = delete;
+    MicrotasksScope& operator=(const MicrotasksScope&) = delete;
+    
+private:
+    Isolate* isolate_;
+    
+    bool run_;
 };
 
 class V8_EXPORT TryCatch {
@@ -1596,10 +2491,19 @@ public:
     
     JSValue catched_;
     
+    //throw null/undefined也算捕获到了，不能靠catched_判断
+    bool has_caught_;
+    
     Isolate* isolate_;
     
     TryCatch* prev_;
     
+    //创建时quickjs的栈帧，之后进入过js的异常不归它捕获
+    void* stack_frame_;
+    
+    //多次调用Message()返回同一个对象
+    mutable Local<v8::Message> message_;
+    
     V8_WARN_UNUSED_RESULT MaybeLocal<Value> StackTrace(Local<Context> context) const;
 
     V8_WARN_UNUSED_RESULT static MaybeLocal<Value> StackTrace(
@@ -76,6 +76,10 @@
 //#define CONFIG_STACK_CHECK
 #endif
 
+/* serve small allocations of the runtimes created by JS_NewRuntime()
+   from per-runtime slabs (usually set by the build) */
+//#define CONFIG_SLAB_ALLOCATOR
+
 
 /* dump object free */
 //#define DUMP_FREE
@@ -289,6 +293,8 @@ struct JSRuntime {
     BOOL can_block : 8; /* TRUE if Atomics.wait can block */
     /* used to allocate, free and clone SharedArrayBuffers */
     JSSharedArrayBufferFunctions sab_funcs;
+    /* used to allocate and free non shared ArrayBuffers (optional) */
+    JSArrayBufferFunctions ab_funcs;
     
     /* Shape hash table */
     int shape_hash_bits;
@@ -401,8 +407,25 @@ typedef enum {
     JS_AUTOINIT_ID_PROTOTYPE,
     JS_AUTOINIT_ID_MODULE_NS,
     JS_AUTOINIT_ID_PROP,
+    JS_AUTOINIT_ID_BACKTRACE,
 } JSAutoInitIDEnum;
 
+/* frames captured by build_backtrace(). The 'stack' string is only
+   formatted from them when the property is read. */
+typedef struct JSBacktraceFrame {
+    JSValue func_name; /* string or JS_UNDEFINED */
+    struct JSFunctionBytecode *b; /* NULL for native functions */
+    uint32_t pc;
+} JSBacktraceFrame;
+
+struct JSBacktrace {
+    int ref_count;
+    JSAtom filename; /* location given by the parser, JS_ATOM_NULL if none */
+    int line_num;
+    int frame_count;
+    JSBacktraceFrame frames[0];
+};
+
 /* must be large enough to have a negligible runtime cost and small
    enough to call the interrupt callback often. */
 #define JS_INTERRUPT_COUNTER_INIT 10000
@@ -886,6 +909,7 @@ struct JSObject {
     /* byte offsets: 28/48 */
     union {
         void *opaque;
+        struct JSBacktrace *backtrace; /* JS_CLASS_ERROR: frames kept once 'stack' is formatted */
         struct JSBoundFunction *bound_function; /* JS_CLASS_BOUND_FUNCTION */
         struct JSCFunctionDataRecord *c_function_data_record; /* JS_CLASS_C_FUNCTION_DATA */
         struct JSForInIterator *for_in_iterator; /* JS_CLASS_FOR_IN_ITERATOR */
@@ -1037,6 +1061,9 @@ static JSValue js_function_apply(JSContext *ctx, JSValueConst this_val,
 static void js_array_finalizer(JSRuntime *rt, JSValue val);
 static void js_array_mark(JSRuntime *rt, JSValueConst val,
                           JS_MarkFunc *mark_func);
+static void js_error_finalizer(JSRuntime *rt, JSValue val);
+static void js_error_mark(JSRuntime *rt, JSValueConst val,
+                          JS_MarkFunc *mark_func);
 static void js_object_data_finalizer(JSRuntime *rt, JSValue val);
 static void js_object_data_mark(JSRuntime *rt, JSValueConst val,
                                 JS_MarkFunc *mark_func);
@@ -1246,6 +1273,14 @@ static JSValue js_module_ns_autoinit(JSContext *ctx, JSObject *p, JSAtom atom,
                                  void *opaque);
 static JSValue JS_InstantiateFunctionListItem2(JSContext *ctx, JSObject *p,
                                                JSAtom atom, void *opaque);
+static JSValue js_backtrace_autoinit(JSContext *ctx, JSObject *p, JSAtom atom,
+                                     void *opaque);
+static int JS_DefineAutoInitProperty(JSContext *ctx, JSValueConst this_obj,
+                                     JSAtom prop, JSAutoInitIDEnum id,
+                                     void *opaque, int flags);
+static void js_backtrace_free(JSRuntime *rt, JSBacktrace *bt);
+static void js_backtrace_mark(JSRuntime *rt, JSBacktrace *bt,
+                              JS_MarkFunc *mark_func);
 void JS_SetUncatchableError(JSContext *ctx, JSValueConst val, BOOL flag);
 
 static const JSClassExoticMethods js_arguments_exotic_methods;
@@ -1441,7 +1476,7 @@ typedef struct JSClassShortDef {
 static JSClassShortDef const js_std_class_def[] = {
     { JS_ATOM_Object, NULL, NULL },                             /* JS_CLASS_OBJECT */
     { JS_ATOM_Array, js_array_finalizer, js_array_mark },       /* JS_CLASS_ARRAY */
-    { JS_ATOM_Error, NULL, NULL }, /* JS_CLASS_ERROR */
+    { JS_ATOM_Error, js_error_finalizer, js_error_mark }, /* JS_CLASS_ERROR */
     { JS_ATOM_Number, js_object_data_finalizer, js_object_data_mark }, /* JS_CLASS_NUMBER */
     { JS_ATOM_String, js_object_data_finalizer, js_object_data_mark }, /* JS_CLASS_STRING */
     { JS_ATOM_Boolean, js_object_data_finalizer, js_object_data_mark }, /* JS_CLASS_BOOLEAN */
@@ -1651,7 +1686,7 @@ JSRuntime *JS_NewRuntime2(const JSMallocFunctions *mf, void *opaque)
 
     rt->stack_top = js_get_stack_pointer();
     rt->stack_size = JS_DEFAULT_STACK_SIZE;
-    rt->current_exception = JS_NULL;
+    rt->current_exception = JS_UNINITIALIZED;
 
     return rt;
  fail:
@@ -1705,6 +1740,9 @@ static void *js_def_malloc(JSMallocState *s, size_t size)
     return ptr;
 }
 
+/* with CONFIG_SLAB_ALLOCATOR, js_def_malloc() is only kept to recognize
+   the default allocator */
+#ifndef CONFIG_SLAB_ALLOCATOR
 static void js_def_free(JSMallocState *s, void *ptr)
 {
     if (!ptr)
@@ -1759,10 +1797,280 @@ static const JSMallocFunctions def_malloc_funcs = {
     malloc_usable_size,
 #endif
 };
+#endif
+
+#ifdef CONFIG_SLAB_ALLOCATOR
+
+/* Size classes tuned for the common small records (with the 8 byte block
+   header): JSString headers with short contents, JSProperty arrays
+   (16 * prop_size), JSObject (72), small JSShape (96 with the initial
+   hash and 2 properties), JSVarRef, JSMapRecord (88). Larger blocks go
+   to malloc(). */
+#define JS_SLAB_SIZE         (64 * 1024)
+#define JS_SLAB_MAX_SIZE     256
+#define JS_SLAB_CLASS_COUNT  16
+/* header word of a large block. Slab blocks store their JSSlab pointer,
+   which is even. */
+#define JS_SLAB_LARGE_TAG    1
+/* large blocks keep the 16 byte alignment of malloc() */
+#define JS_SLAB_LARGE_HEADER 16
+/* Slab blocks are only 8 byte aligned: the header word is padded to 8
+   bytes (also on 32 bit targets) and the class sizes are multiples of 8.
+   This is enough because no runtime record stores a type with a larger
+   alignment (the 16 bytes of malloc() come from long double, which is
+   not used; the libbf 128 bit limbs only live in registers). Aligning
+   the classes to 16 would cost up to 8 bytes per small record. */
+#define JS_SLAB_HEADER       8
+
+static const uint16_t js_slab_class_size[JS_SLAB_CLASS_COUNT] = {
+    16, 24, 32, 40, 48, 56, 64, 72, 80, 88, 96, 112, 128, 160, 192, 256,
+};
+
+typedef struct JSSlabClass JSSlabClass;
+
+typedef struct JSSlab {
+    struct list_head link; /* JSSlabClass.slabs */
+    struct list_head partial_link; /* JSSlabClass.partial when not full */
+    JSSlabClass *cls;
+    void *free_list; /* freed blocks */
+    uint32_t bump; /* blocks never allocated start here */
+    uint32_t used;
+} JSSlab;
+
+struct JSSlabClass {
+    uint32_t size; /* payload size */
+    uint32_t capacity; /* blocks per slab */
+    uint32_t slab_count;
+    uint32_t empty_count;
+    size_t used_count;
+    struct list_head slabs;
+    struct list_head partial; /* slabs with at least one free block */
+};
+
+typedef struct JSSlabAllocator {
+    JSSlabClass classes[JS_SLAB_CLASS_COUNT];
+    uint8_t class_index[(JS_SLAB_MAX_SIZE >> 3) + 1];
+} JSSlabAllocator;
+
+static JSSlabAllocator *js_slab_new(void)
+{
+    JSSlabAllocator *sa;
+    JSSlabClass *cls;
+    int i, j;
+
+    sa = malloc(sizeof(*sa));
+    if (!sa)
+        return NULL;
+    j = 0;
+    for(i = 0; i < JS_SLAB_CLASS_COUNT; i++) {
+        cls = &sa->classes[i];
+        cls->size = js_slab_class_size[i];
+        cls->capacity = (JS_SLAB_SIZE - sizeof(JSSlab)) /
+            (cls->size + JS_SLAB_HEADER);
+        cls->slab_count = 0;
+        cls->empty_count = 0;
+        cls->used_count = 0;
+        init_list_head(&cls->slabs);
+        init_list_head(&cls->partial);
+        for(; j <= (cls->size >> 3); j++)
+            sa->class_index[j] = i;
+    }
+    return sa;
+}
+
+/* release every slab, including the blocks still in use */
+static void js_slab_free_all(JSSlabAllocator *sa)
+{
+    struct list_head *el, *el1;
+    int i;
+
+    for(i = 0; i < JS_SLAB_CLASS_COUNT; i++) {
+        list_for_each_safe(el, el1, &sa->classes[i].slabs) {
+            free(list_entry(el, JSSlab, link));
+        }
+    }
+    free(sa);
+}
+
+/* payload of the i-th block. sizeof(JSSlab) is a multiple of 8. */
+static inline uint8_t *js_slab_block(JSSlab *slab, uint32_t i)
+{
+    return (uint8_t *)(slab + 1) +
+        i * (slab->cls->size + JS_SLAB_HEADER) + JS_SLAB_HEADER;
+}
+
+static size_t js_slab_usable_size(const void *ptr)
+{
+    uintptr_t tag;
+
+    if (!ptr)
+        return 0;
+    tag = ((const uintptr_t *)ptr)[-1];
+    if (tag == JS_SLAB_LARGE_TAG)
+        return js_def_malloc_usable_size((void *)((const uint8_t *)ptr -
+                                                  JS_SLAB_LARGE_HEADER)) -
+            JS_SLAB_LARGE_HEADER;
+    return ((JSSlab *)tag)->cls->size;
+}
+
+static void *js_slab_malloc(JSMallocState *s, size_t size)
+{
+    JSSlabAllocator *sa = s->opaque;
+    JSSlabClass *cls;
+    JSSlab *slab;
+    uint8_t *ptr;
+
+    assert(size != 0);
+
+    if (unlikely(s->malloc_size + size > s->malloc_limit))
+        return NULL;
+
+    if (size > JS_SLAB_MAX_SIZE) {
+        ptr = malloc(size + JS_SLAB_LARGE_HEADER);
+        if (!ptr)
+            return NULL;
+        ptr += JS_SLAB_LARGE_HEADER;
+        ((uintptr_t *)ptr)[-1] = JS_SLAB_LARGE_TAG;
+        s->malloc_count++;
+        s->malloc_size += js_slab_usable_size(ptr) + JS_SLAB_LARGE_HEADER +
+            MALLOC_OVERHEAD;
+        return ptr;
+    }
+
+    cls = &sa->classes[sa->class_index[(size + 7) >> 3]];
+    if (unlikely(list_empty(&cls->partial))) {
+        slab = malloc(JS_SLAB_SIZE);
+        if (!slab)
+            return NULL;
+        slab->cls = cls;
+        slab->free_list = NULL;
+        slab->bump = 0;
+        slab->used = 0;
+        list_add_tail(&slab->link, &cls->slabs);
+        list_add(&slab->partial_link, &cls->partial);
+        cls->slab_count++;
+        cls->empty_count++;
+    } else {
+        slab = list_entry(cls->partial.next, JSSlab, partial_link);
+    }
+    if (slab->free_list) {
+        ptr = slab->free_list;
+        slab->free_list = *(void **)ptr;
+    } else {
+        ptr = js_slab_block(slab, slab->bump++);
+    }
+    if (slab->used++ == 0)
+        cls->empty_count--;
+    if (slab->used == cls->capacity)
+        list_del(&slab->partial_link);
+    cls->used_count++;
+    ((uintptr_t *)ptr)[-1] = (uintptr_t)slab;
+    s->malloc_count++;
+    s->malloc_size += cls->size + JS_SLAB_HEADER;
+    return ptr;
+}
+
+static void js_slab_free(JSMallocState *s, void *ptr)
+{
+    JSSlabClass *cls;
+    JSSlab *slab;
+    uintptr_t tag;
+
+    if (!ptr)
+        return;
+    tag = ((uintptr_t *)ptr)[-1];
+    s->malloc_count--;
+    if (tag == JS_SLAB_LARGE_TAG) {
+        s->malloc_size -= js_slab_usable_size(ptr) + JS_SLAB_LARGE_HEADER +
+            MALLOC_OVERHEAD;
+        free((uint8_t *)ptr - JS_SLAB_LARGE_HEADER);
+        return;
+    }
+    slab = (JSSlab *)tag;
+    cls = slab->cls;
+    s->malloc_size -= cls->size + JS_SLAB_HEADER;
+    cls->used_count--;
+    if (slab->used-- == cls->capacity)
+        list_add(&slab->partial_link, &cls->partial);
+    if (slab->used == 0) {
+        /* keep one empty slab per class to avoid thrashing */
+        if (cls->empty_count > 0) {
+            list_del(&slab->partial_link);
+            list_del(&slab->link);
+            cls->slab_count--;
+            free(slab);
+            return;
+        }
+        cls->empty_count++;
+    }
+    *(void **)ptr = slab->free_list;
+    slab->free_list = ptr;
+}
+
+static void *js_slab_realloc(JSMallocState *s, void *ptr, size_t size)
+{
+    size_t old_size;
+    uint8_t *ptr1;
+
+    if (!ptr) {
+        if (size == 0)
+            return NULL;
+        return js_slab_malloc(s, size);
+    }
+    if (size == 0) {
+        js_slab_free(s, ptr);
+        return NULL;
+    }
+    old_size = js_slab_usable_size(ptr);
+    if (((uintptr_t *)ptr)[-1] == JS_SLAB_LARGE_TAG) {
+        if (size > JS_SLAB_MAX_SIZE) {
+            if (s->malloc_size + size - old_size > s->malloc_limit)
+                return NULL;
+            ptr1 = realloc((uint8_t *)ptr - JS_SLAB_LARGE_HEADER,
+                           size + JS_SLAB_LARGE_HEADER);
+            if (!ptr1)
+                return NULL;
+            ptr1 += JS_SLAB_LARGE_HEADER;
+            s->malloc_size += js_slab_usable_size(ptr1) - old_size;
+            return ptr1;
+        }
+    } else if (size <= old_size) {
+        /* the block does not shrink to a smaller class */
+        return ptr;
+    }
+    ptr1 = js_slab_malloc(s, size);
+    if (!ptr1)
+        return NULL;
+    memcpy(ptr1, ptr, min_int(old_size, size));
+    js_slab_free(s, ptr);
+    return ptr1;
+}
+
+static const JSMallocFunctions slab_malloc_funcs = {
+    js_slab_malloc,
+    js_slab_free,
+    js_slab_realloc,
+    js_slab_usable_size,
+};
+
+#endif /* CONFIG_SLAB_ALLOCATOR */
 
 JSRuntime *JS_NewRuntime(void)
 {
+#ifdef CONFIG_SLAB_ALLOCATOR
+    JSSlabAllocator *sa;
+    JSRuntime *rt;
+
+    sa = js_slab_new();
+    if (!sa)
+        return NULL;
+    rt = JS_NewRuntime2(&slab_malloc_funcs, sa);
+    if (!rt)
+        js_slab_free_all(sa);
+    return rt;
+#else
     return JS_NewRuntime2(&def_malloc_funcs, NULL);
+#endif
 }
 
 void JS_SetMemoryLimit(JSRuntime *rt, size_t limit)
@@ -1926,6 +2234,7 @@ void JS_FreeRuntime(JSRuntime *rt)
     int i;
 
     JS_FreeValueRT(rt, rt->current_exception);
+    rt->current_exception = JS_UNINITIALIZED;
 
     list_for_each_safe(el, el1, &rt->job_list) {
         JSJobEntry *e = list_entry(el, JSJobEntry, link);
@@ -2104,7 +2413,15 @@ void JS_FreeRuntime(JSRuntime *rt)
 
     {
         JSMallocState ms = rt->malloc_state;
+#ifdef CONFIG_SLAB_ALLOCATOR
+        BOOL is_slab = (rt->mf.js_malloc == js_slab_malloc);
+#endif
         rt->mf.js_free(&ms, rt);
+#ifdef CONFIG_SLAB_ALLOCATOR
+        /* the slabs are released as a whole */
+        if (is_slab)
+            js_slab_free_all(ms.opaque);
+#endif
     }
 }
 
@@ -2213,9 +2530,12 @@ static void js_free_modules(JSContext *ctx, JSFreeModuleEnum flag)
     struct list_head *el, *el1;
     list_for_each_safe(el, el1, &ctx->loaded_modules) {
         JSModuleDef *m = list_entry(el, JSModuleDef, link);
+        /* modules still referenced by the host (v8 api Module) are
+           only freed with the context */
         if (flag == JS_FREE_MODULE_ALL ||
-            (flag == JS_FREE_MODULE_NOT_RESOLVED && !m->resolved) ||
-            (flag == JS_FREE_MODULE_NOT_EVALUATED && !m->evaluated)) {
+            (m->header.ref_count <= 1 &&
+             ((flag == JS_FREE_MODULE_NOT_RESOLVED && !m->resolved) ||
+              (flag == JS_FREE_MODULE_NOT_EVALUATED && !m->evaluated)))) {
             js_free_module_def(ctx, m);
         }
     }
@@ -5132,12 +5452,16 @@ static JSAutoInitIDEnum js_autoinit_get_id(JSProperty *pr)
 
 static void js_autoinit_free(JSRuntime *rt, JSProperty *pr)
 {
+    if (js_autoinit_get_id(pr) == JS_AUTOINIT_ID_BACKTRACE)
+        js_backtrace_free(rt, pr->u.init.opaque);
     JS_FreeContext(js_autoinit_get_realm(pr));
 }
 
 static void js_autoinit_mark(JSRuntime *rt, JSProperty *pr,
                              JS_MarkFunc *mark_func)
 {
+    if (js_autoinit_get_id(pr) == JS_AUTOINIT_ID_BACKTRACE)
+        js_backtrace_mark(rt, pr->u.init.opaque, mark_func);
     mark_func(rt, &js_autoinit_get_realm(pr)->header);
 }
 
@@ -6071,12 +6395,14 @@ void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s)
         case JS_CLASS_SHARED_ARRAY_BUFFER: /* u.array_buffer */
             {
                 JSArrayBuffer *abuf = p->u.array_buffer;
+                s->array_buffer_count++;
                 if (abuf) {
                     s->memory_used_count += 1;
                     s->memory_used_size += sizeof(*abuf);
                     if (abuf->data) {
                         s->memory_used_count += 1;
                         s->memory_used_size += abuf->byte_length;
+                        s->array_buffer_size += abuf->byte_length;
                     }
                 }
             }
@@ -6315,7 +6641,7 @@ JSValue JS_GetException(JSContext *ctx)
     JSValue val;
     JSRuntime *rt = ctx->rt;
     val = rt->current_exception;
-    rt->current_exception = JS_NULL;
+    rt->current_exception = JS_UNINITIALIZED;
     return val;
 }
 
@@ -6422,82 +6748,136 @@ static int find_line_num(JSContext *ctx, JSFunctionBytecode *b,
 /* in order to avoid executing arbitrary code during the stack trace
    generation, we only look at simple 'name' properties containing a
    string. */
-static const char *get_func_name(JSContext *ctx, JSValueConst func)
-{
-    JSProperty *pr;
-    JSShapeProperty *prs;
-    JSValueConst val;
-    
-    if (JS_VALUE_GET_TAG(func) != JS_TAG_OBJECT)
-        return NULL;
-    prs = find_own_property(&pr, JS_VALUE_GET_OBJ(func), JS_ATOM_name);
-    if (!prs)
-        return NULL;
-    if ((prs->flags & JS_PROP_TMASK) != JS_PROP_NORMAL)
-        return NULL;
-    val = pr->u.value;
-    if (JS_VALUE_GET_TAG(val) != JS_TAG_STRING)
-        return NULL;
-    return JS_ToCString(ctx, val);
-}
-
 #define JS_BACKTRACE_FLAG_SKIP_FIRST_LEVEL (1 << 0)
 /* only taken into account if filename is provided */
 #define JS_BACKTRACE_FLAG_SINGLE_LEVEL     (1 << 1)
 
 /* if filename != NULL, an additional level is added with the filename
    and line number information (used for parse error). */
-static void build_backtrace(JSContext *ctx, JSValueConst error_obj,
-                            const char *filename, int line_num,
-                            int backtrace_flags)
+/* capture at most 'max_frames' stack frames without formatting them */
+static JSBacktrace *js_capture_backtrace(JSContext *ctx, const char *filename,
+                                         int line_num, int backtrace_flags,
+                                         int max_frames)
 {
     JSStackFrame *sf;
-    JSValue str;
-    DynBuf dbuf;
-    const char *func_name_str;
-    const char *str1;
+    JSBacktrace *bt;
+    JSBacktraceFrame *f;
     JSObject *p;
-    BOOL backtrace_barrier;
-    
-    js_dbuf_init(ctx, &dbuf);
-    if (filename) {
-        dbuf_printf(&dbuf, "    at %s", filename);
-        if (line_num != -1)
-            dbuf_printf(&dbuf, ":%d", line_num);
-        dbuf_putc(&dbuf, '\n');
-        str = JS_NewString(ctx, filename);
-        JS_DefinePropertyValue(ctx, error_obj, JS_ATOM_fileName, str,
-                               JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
-        JS_DefinePropertyValue(ctx, error_obj, JS_ATOM_lineNumber, JS_NewInt32(ctx, line_num),
-                               JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
-        if (backtrace_flags & JS_BACKTRACE_FLAG_SINGLE_LEVEL)
-            goto done;
+    JSProperty *pr;
+    JSShapeProperty *prs;
+    int n, skip_first;
+
+    n = 0;
+    if (!filename || !(backtrace_flags & JS_BACKTRACE_FLAG_SINGLE_LEVEL)) {
+        skip_first = backtrace_flags & JS_BACKTRACE_FLAG_SKIP_FIRST_LEVEL;
+        for(sf = ctx->rt->current_stack_frame; sf != NULL && n < max_frames;
+            sf = sf->prev_frame) {
+            if (skip_first) {
+                skip_first = 0;
+                continue;
+            }
+            n++;
+            /* stop backtrace if JS_EVAL_FLAG_BACKTRACE_BARRIER was used */
+            p = JS_VALUE_GET_OBJ(sf->cur_func);
+            if (js_class_has_bytecode(p->class_id) &&
+                p->u.func.function_bytecode->backtrace_barrier)
+                break;
+        }
     }
-    for(sf = ctx->rt->current_stack_frame; sf != NULL; sf = sf->prev_frame) {
-        if (backtrace_flags & JS_BACKTRACE_FLAG_SKIP_FIRST_LEVEL) {
-            backtrace_flags &= ~JS_BACKTRACE_FLAG_SKIP_FIRST_LEVEL;
+    bt = js_malloc(ctx, sizeof(*bt) + n * sizeof(bt->frames[0]));
+    if (!bt)
+        return NULL;
+    bt->ref_count = 1;
+    bt->filename = filename ? JS_NewAtom(ctx, filename) : JS_ATOM_NULL;
+    bt->line_num = line_num;
+    bt->frame_count = n;
+    skip_first = backtrace_flags & JS_BACKTRACE_FLAG_SKIP_FIRST_LEVEL;
+    f = bt->frames;
+    for(sf = ctx->rt->current_stack_frame; f < bt->frames + n;
+        sf = sf->prev_frame) {
+        if (skip_first) {
+            skip_first = 0;
             continue;
         }
-        func_name_str = get_func_name(ctx, sf->cur_func);
-        if (!func_name_str || func_name_str[0] == '\0')
-            str1 = "<anonymous>";
-        else
-            str1 = func_name_str;
-        dbuf_printf(&dbuf, "    at %s", str1);
-        JS_FreeCString(ctx, func_name_str);
-
         p = JS_VALUE_GET_OBJ(sf->cur_func);
-        backtrace_barrier = FALSE;
+        /* only an own 'name' data property holding a string is used */
+        f->func_name = JS_UNDEFINED;
+        prs = find_own_property(&pr, p, JS_ATOM_name);
+        if (prs && (prs->flags & JS_PROP_TMASK) == JS_PROP_NORMAL &&
+            JS_VALUE_GET_TAG(pr->u.value) == JS_TAG_STRING)
+            f->func_name = JS_DupValue(ctx, pr->u.value);
         if (js_class_has_bytecode(p->class_id)) {
-            JSFunctionBytecode *b;
-            const char *atom_str;
-            int line_num1;
+            f->b = p->u.func.function_bytecode;
+            JS_DupValue(ctx, JS_MKPTR(JS_TAG_FUNCTION_BYTECODE, f->b));
+            f->pc = sf->cur_pc - f->b->byte_code_buf - 1;
+        } else {
+            f->b = NULL;
+            f->pc = 0;
+        }
+        f++;
+    }
+    return bt;
+}
 
-            b = p->u.func.function_bytecode;
-            backtrace_barrier = b->backtrace_barrier;
+static void js_backtrace_free(JSRuntime *rt, JSBacktrace *bt)
+{
+    int i;
+
+    if (!bt || --bt->ref_count > 0)
+        return;
+    for(i = 0; i < bt->frame_count; i++) {
+        JS_FreeValueRT(rt, bt->frames[i].func_name);
+        if (bt->frames[i].b)
+            JS_FreeValueRT(rt, JS_MKPTR(JS_TAG_FUNCTION_BYTECODE,
+                                        bt->frames[i].b));
+    }
+    JS_FreeAtomRT(rt, bt->filename);
+    js_free_rt(rt, bt);
+}
+
+static void js_backtrace_mark(JSRuntime *rt, JSBacktrace *bt,
+                              JS_MarkFunc *mark_func)
+{
+    int i;
+
+    for(i = 0; i < bt->frame_count; i++) {
+        if (bt->frames[i].b)
+            mark_func(rt, &bt->frames[i].b->header);
+    }
+}
+
+/* same text as the eager backtrace used to produce */
+static JSValue js_backtrace_to_string(JSContext *ctx, JSBacktrace *bt)
+{
+    JSBacktraceFrame *f;
+    JSFunctionBytecode *b;
+    DynBuf dbuf;
+    const char *str1;
+    const char *atom_str;
+    JSValue str;
+    int i, line_num1;
+
+    js_dbuf_init(ctx, &dbuf);
+    if (bt->filename != JS_ATOM_NULL) {
+        atom_str = JS_AtomToCString(ctx, bt->filename);
+        dbuf_printf(&dbuf, "    at %s", atom_str ? atom_str : "<null>");
+        JS_FreeCString(ctx, atom_str);
+        if (bt->line_num != -1)
+            dbuf_printf(&dbuf, ":%d", bt->line_num);
+        dbuf_putc(&dbuf, '\n');
+    }
+    for(i = 0; i < bt->frame_count; i++) {
+        f = &bt->frames[i];
+        str1 = NULL;
+        if (!JS_IsUndefined(f->func_name))
+            str1 = JS_ToCString(ctx, f->func_name);
+        dbuf_printf(&dbuf, "    at %s",
+                    (!str1 || str1[0] == '\0') ? "<anonymous>" : str1);
+        JS_FreeCString(ctx, str1);
+        b = f->b;
+        if (b) {
             if (b->has_debug) {
-                line_num1 = find_line_num(ctx, b,
-                                          sf->cur_pc - b->byte_code_buf - 1);
+                line_num1 = find_line_num(ctx, b, f->pc);
                 atom_str = JS_AtomToCString(ctx, b->debug.filename);
                 dbuf_printf(&dbuf, " (%s",
                             atom_str ? atom_str : "<null>");
@@ -6510,17 +6890,82 @@ static void build_backtrace(JSContext *ctx, JSValueConst error_obj,
             dbuf_printf(&dbuf, " (native)");
         }
         dbuf_putc(&dbuf, '\n');
-        /* stop backtrace if JS_EVAL_FLAG_BACKTRACE_BARRIER was used */
-        if (backtrace_barrier)
-            break;
     }
- done:
     dbuf_putc(&dbuf, '\0');
     if (dbuf_error(&dbuf))
         str = JS_NULL;
     else
         str = JS_NewString(ctx, (char *)dbuf.buf);
     dbuf_free(&dbuf);
+    return str;
+}
+
+/* keep the frames on the error object so that JS_GetErrorBacktrace()
+   still works once 'stack' is a plain string */
+static void js_error_keep_backtrace(JSObject *p, JSBacktrace *bt)
+{
+    if (p->class_id == JS_CLASS_ERROR && !p->u.backtrace) {
+        bt->ref_count++;
+        p->u.backtrace = bt;
+    }
+}
+
+static void js_error_finalizer(JSRuntime *rt, JSValue val)
+{
+    JSObject *p = JS_VALUE_GET_OBJ(val);
+    js_backtrace_free(rt, p->u.backtrace);
+}
+
+static void js_error_mark(JSRuntime *rt, JSValueConst val,
+                          JS_MarkFunc *mark_func)
+{
+    JSObject *p = JS_VALUE_GET_OBJ(val);
+    if (p->u.backtrace)
+        js_backtrace_mark(rt, p->u.backtrace, mark_func);
+}
+
+static JSValue js_backtrace_autoinit(JSContext *ctx, JSObject *p, JSAtom atom,
+                                     void *opaque)
+{
+    /* 'opaque' is released by js_autoinit_free() */
+    js_error_keep_backtrace(p, opaque);
+    return js_backtrace_to_string(ctx, opaque);
+}
+
+static void build_backtrace(JSContext *ctx, JSValueConst error_obj,
+                            const char *filename, int line_num,
+                            int backtrace_flags)
+{
+    JSBacktrace *bt;
+    JSObject *p;
+    JSValue str;
+
+    if (filename) {
+        str = JS_NewString(ctx, filename);
+        JS_DefinePropertyValue(ctx, error_obj, JS_ATOM_fileName, str,
+                               JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
+        JS_DefinePropertyValue(ctx, error_obj, JS_ATOM_lineNumber, JS_NewInt32(ctx, line_num),
+                               JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
+    }
+    bt = js_capture_backtrace(ctx, filename, line_num, backtrace_flags,
+                              INT32_MAX);
+    if (!bt) {
+        str = JS_NULL;
+    } else {
+        /* the common case: format the frames only if 'stack' is read */
+        if (JS_VALUE_GET_TAG(error_obj) == JS_TAG_OBJECT) {
+            p = JS_VALUE_GET_OBJ(error_obj);
+            if (p->extensible && !find_own_property1(p, JS_ATOM_stack) &&
+                JS_DefineAutoInitProperty(ctx, error_obj, JS_ATOM_stack,
+                                          JS_AUTOINIT_ID_BACKTRACE, bt,
+                                          JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE) > 0)
+                return;
+        }
+        if (JS_VALUE_GET_TAG(error_obj) == JS_TAG_OBJECT)
+            js_error_keep_backtrace(JS_VALUE_GET_OBJ(error_obj), bt);
+        str = js_backtrace_to_string(ctx, bt);
+        js_backtrace_free(ctx->rt, bt);
+    }
     JS_DefinePropertyValue(ctx, error_obj, JS_ATOM_stack, str,
                            JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
 }
@@ -7023,6 +7468,7 @@ static JSAutoInitFunc *js_autoinit_func_table[] = {
     js_instantiate_prototype, /* JS_AUTOINIT_ID_PROTOTYPE */
     js_module_ns_autoinit, /* JS_AUTOINIT_ID_MODULE_NS */
     JS_InstantiateFunctionListItem2, /* JS_AUTOINIT_ID_PROP */
+    js_backtrace_autoinit, /* JS_AUTOINIT_ID_BACKTRACE */
 };
 
 /* warning: 'prs' is reallocated after it */
@@ -15306,7 +15752,7 @@ static int JS_IteratorClose(JSContext *ctx, JSValueConst enum_obj,
 
     if (is_exception_pending) {
         ex_obj = ctx->rt->current_exception;
-        ctx->rt->current_exception = JS_NULL;
+        ctx->rt->current_exception = JS_UNINITIALIZED;
         res = -1;
     } else {
         ex_obj = JS_UNDEFINED;
@@ -18585,7 +19031,7 @@ static JSValue JS_CallInternal(JSContext *caller_ctx, JSValueConst func_obj,
                     JS_IteratorClose(ctx, sp[-1], TRUE);
                 } else {
                     *sp++ = rt->current_exception;
-                    rt->current_exception = JS_NULL;
+                    rt->current_exception = JS_UNINITIALIZED;
                     pc = b->byte_code_buf + pos;
                     goto restart;
                 }
@@ -33568,10 +34014,9 @@ static JSValue __JS_EvalInternal(JSContext *ctx, JSValueConst this_obj,
     fun_obj = js_create_function(ctx, fd);
     if (JS_IsException(fun_obj))
         goto fail1;
-    /* Could add a flag to avoid resolution if necessary */
     if (m) {
         m->func_obj = fun_obj;
-        if (js_resolve_module(ctx, m) < 0)
+        if (!(flags & JS_EVAL_FLAG_NO_RESOLVE) && js_resolve_module(ctx, m) < 0)
             goto fail1;
         fun_obj = JS_DupValue(ctx, JS_MKPTR(JS_TAG_MODULE, m));
     }
@@ -50869,6 +51314,11 @@ static uint8_t const typed_array_size_log2[JS_TYPED_ARRAY_COUNT] = {
     2, 3
 };
 
+static void js_array_buffer_ab_free(JSRuntime *rt, void *opaque, void *ptr)
+{
+    rt->ab_funcs.ab_free(rt->ab_funcs.ab_opaque, ptr, (uintptr_t)opaque);
+}
+
 static JSValue js_array_buffer_constructor3(JSContext *ctx,
                                             JSValueConst new_target,
                                             uint64_t len, JSClassID class_id,
@@ -50900,6 +51350,17 @@ static JSValue js_array_buffer_constructor3(JSContext *ctx,
             if (!abuf->data)
                 goto fail;
             memset(abuf->data, 0, len);
+        } else if (class_id != JS_CLASS_SHARED_ARRAY_BUFFER &&
+                   rt->ab_funcs.ab_alloc) {
+            /* the size is kept in 'opaque' because ab_free() needs it */
+            abuf->data = rt->ab_funcs.ab_alloc(rt->ab_funcs.ab_opaque,
+                                               max_int(len, 1), !buf);
+            if (!abuf->data) {
+                JS_ThrowOutOfMemory(ctx);
+                goto fail;
+            }
+            free_func = js_array_buffer_ab_free;
+            opaque = (void *)(uintptr_t)max_int(len, 1);
         } else {
             /* the allocation must be done after the object creation */
             abuf->data = js_mallocz(ctx, max_int(len, 1));
@@ -53849,6 +54310,18 @@ JS_BOOL JS_IsArrayBuffer(JSValueConst obj)
     return p->class_id == JS_CLASS_ARRAY_BUFFER;
 }
 
+JS_BOOL JS_IsSharedArrayBuffer(JSValueConst obj)
+{
+    JSObject *p;
+    if (JS_VALUE_GET_TAG(obj) != JS_TAG_OBJECT)
+    {
+        return FALSE;
+    }
+    p = JS_VALUE_GET_OBJ(obj);
+    
+    return p->class_id == JS_CLASS_SHARED_ARRAY_BUFFER;
+}
+
 JS_BOOL JS_IsArrayBufferView(JSValueConst obj)
 {
     JSObject *p;
@@ -54057,4 +54530,681 @@ JSValue JS_MapDelete(JSContext *ctx, JSValueConst this_val,
     map_delete_record(ctx->rt, s, mr);
     return JS_TRUE;
 }
+
+uint32_t JS_GetStringLength(JSValueConst val)
+{
+    return JS_VALUE_GET_STRING(val)->len;
+}
+
+JS_BOOL JS_IsOneByteString(JSValueConst val)
+{
+    return !JS_VALUE_GET_STRING(val)->is_wide_char;
+}
+
+/* internal Latin-1 storage (null terminated), NULL for 16 bit strings */
+const uint8_t *JS_GetStringOneByteData(JSValueConst val)
+{
+    JSString *p = JS_VALUE_GET_STRING(val);
+    return p->is_wide_char ? NULL : p->u.str8;
+}
+
+JSValue JS_NewOneByteString(JSContext *ctx, const uint8_t *buf, size_t len)
+{
+    if (len > JS_STRING_LEN_MAX)
+        return JS_ThrowInternalError(ctx, "string too long");
+    return js_new_string8(ctx, buf, len);
+}
+
+/* stored as 8 bit if all the characters are Latin-1 */
+JSValue JS_NewTwoByteString(JSContext *ctx, const uint16_t *buf, size_t len)
+{
+    JSString *str;
+    size_t i;
+    uint16_t c = 0;
+    
+    if (len > JS_STRING_LEN_MAX)
+        return JS_ThrowInternalError(ctx, "string too long");
+    for (i = 0; i < len; i++)
+        c |= buf[i];
+    if (c >= 0x100)
+        return js_new_string16(ctx, buf, len);
+    if (len == 0)
+        return JS_AtomToString(ctx, JS_ATOM_empty_string);
+    str = js_alloc_string(ctx, len, 0);
+    if (!str)
+        return JS_EXCEPTION;
+    for (i = 0; i < len; i++)
+        str->u.str8[i] = buf[i];
+    str->u.str8[len] = '\0';
+    return JS_MKPTR(JS_TAG_STRING, str);
+}
+
+/* return an atom backed string (internalized), consume 'str' */
+JSValue JS_InternString(JSContext *ctx, JSValue str)
+{
+    JSAtom atom;
+    JSValue ret;
+    
+    if (JS_IsException(str))
+        return str;
+    atom = JS_NewAtomStr(ctx, JS_VALUE_GET_STRING(str));
+    if (atom == JS_ATOM_NULL)
+        return JS_EXCEPTION;
+    ret = JS_AtomToString(ctx, atom);
+    JS_FreeAtom(ctx, atom);
+    return ret;
+}
+
+/* same as JS_ValueToAtom() but atom backed strings are not hashed again */
+JSAtom JS_ValueToAtomFast(JSContext *ctx, JSValueConst val)
+{
+    if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING) {
+        JSString *p = JS_VALUE_GET_STRING(val);
+        if (p->atom_type == JS_ATOM_TYPE_STRING)
+            return JS_DupAtom(ctx, js_get_atom_index(ctx->rt, p));
+    }
+    return JS_ValueToAtom(ctx, val);
+}
+
+/* internal storage if the string is 8 bit and pure ASCII, NULL otherwise */
+const char *JS_GetStringASCIIData(JSValueConst val)
+{
+    JSString *p = JS_VALUE_GET_STRING(val);
+    uint32_t i, count = 0;
+    
+    if (p->is_wide_char)
+        return NULL;
+    for (i = 0; i < p->len; i++)
+        count += p->u.str8[i] >> 7;
+    return count == 0 ? (const char *)p->u.str8 : NULL;
+}
+
+void JS_CopyStringUTF16(JSValueConst val, uint16_t *buf, uint32_t start, uint32_t len)
+{
+    JSString *p = JS_VALUE_GET_STRING(val);
+    uint32_t i;
+    
+    if (p->is_wide_char) {
+        memcpy(buf, p->u.str16 + start, len * sizeof(uint16_t));
+    } else {
+        for (i = 0; i < len; i++)
+            buf[i] = p->u.str8[start + i];
+    }
+}
+
+/* 16 bit characters are truncated to their low byte */
+void JS_CopyStringOneByte(JSValueConst val, uint8_t *buf, uint32_t start, uint32_t len)
+{
+    JSString *p = JS_VALUE_GET_STRING(val);
+    uint32_t i;
+    
+    if (p->is_wide_char) {
+        for (i = 0; i < len; i++)
+            buf[i] = (uint8_t)p->u.str16[start + i];
+    } else {
+        memcpy(buf, p->u.str8 + start, len);
+    }
+}
+
+/* same encoding as JS_ToCStringLen(): unmatched surrogates take 3 bytes */
+size_t JS_GetStringUtf8Length(JSValueConst val)
+{
+    JSString *p = JS_VALUE_GET_STRING(val);
+    size_t n = 0;
+    uint32_t i, len = p->len;
+    
+    if (!p->is_wide_char) {
+        const uint8_t *src = p->u.str8;
+        uint32_t count = 0;
+        for (i = 0; i < len; i++)
+            count += src[i] >> 7;
+        return (size_t)len + count;
+    } else {
+        const uint16_t *src = p->u.str16;
+        for (i = 0; i < len; i++) {
+            uint32_t c = src[i];
+            if (c < 0x80) {
+                n += 1;
+            } else if (c < 0x800) {
+                n += 2;
+            } else if (c >= 0xd800 && c < 0xdc00 && i + 1 < len &&
+                       src[i + 1] >= 0xdc00 && src[i + 1] < 0xe000) {
+                n += 4;
+                i++;
+            } else {
+                n += 3;
+            }
+        }
+        return n;
+    }
+}
+
+/* Write at most 'capacity' bytes of UTF-8 without splitting a character
+   and without a null terminator. Return the number of bytes written and
+   the number of UTF-16 code units consumed in *pnchars. Unmatched
+   surrogates are written as U+FFFD if 'replace_invalid' is set. */
+size_t JS_WriteStringUtf8(JSValueConst val, char *buf, size_t capacity,
+                          int *pnchars, JS_BOOL replace_invalid)
+{
+    JSString *p = JS_VALUE_GET_STRING(val);
+    uint8_t *q = (uint8_t *)buf;
+    uint8_t *q_end;
+    uint32_t pos = 0, len = p->len;
+    
+    /* clamp first: 'capacity' may be SIZE_MAX and 'buf + capacity' would
+       then be out of range */
+    if (capacity > (size_t)len * 3)
+        capacity = (size_t)len * 3;
+    q_end = q + capacity;
+    
+    if (!p->is_wide_char) {
+        const uint8_t *src = p->u.str8;
+        uint32_t count = 0;
+        /* same trick as JS_ToCStringLen(): counting is cheaper than testing */
+        for (pos = 0; pos < len; pos++)
+            count += src[pos] >> 7;
+        pos = 0;
+        if (count == 0) {
+            pos = min_uint32(len, q_end - q);
+            memcpy(q, src, pos);
+            q += pos;
+        } else {
+            while (pos < len) {
+                uint32_t c = src[pos];
+                if (c < 0x80) {
+                    if (q >= q_end)
+                        break;
+                    *q++ = c;
+                } else {
+                    if (q_end - q < 2)
+                        break;
+                    *q++ = (c >> 6) | 0xc0;
+                    *q++ = (c & 0x3f) | 0x80;
+                }
+                pos++;
+            }
+        }
+    } else {
+        const uint16_t *src = p->u.str16;
+        while (pos < len) {
+            uint32_t c = src[pos], n = 1;
+            if (c < 0x80) {
+                if (q >= q_end)
+                    break;
+                *q++ = c;
+            } else {
+                if (c >= 0xd800 && c < 0xe000) {
+                    uint32_t c1;
+                    if (c < 0xdc00 && pos + 1 < len &&
+                        (c1 = src[pos + 1]) >= 0xdc00 && c1 < 0xe000) {
+                        c = (((c & 0x3ff) << 10) | (c1 & 0x3ff)) + 0x10000;
+                        n = 2;
+                    } else if (replace_invalid) {
+                        c = 0xfffd;
+                    }
+                }
+                if (q_end - q < (c < 0x800 ? 2 : (c < 0x10000 ? 3 : 4)))
+                    break;
+                q += unicode_to_utf8(q, c);
+            }
+            pos += n;
+        }
+    }
+    if (pnchars)
+        *pnchars = pos;
+    return q - (uint8_t *)buf;
+}
+
+int JS_InstantiateModule(JSContext *ctx, JSModuleDef *m)
+{
+    if (js_resolve_module(ctx, m) < 0)
+        return -1;
+    if (js_create_module_function(ctx, m) < 0)
+        return -1;
+    return js_link_module(ctx, m);
+}
+
+JSValue JS_EvaluateModule(JSContext *ctx, JSModuleDef *m)
+{
+    return js_evaluate_module(ctx, m);
+}
+
+/* 0: not instantiated, 1: instantiated, 2: evaluated, 3: evaluated with exception */
+int JS_GetModuleStatus(JSModuleDef *m)
+{
+    if (m->evaluated)
+        return m->eval_has_exception ? 3 : 2;
+    return m->instantiated ? 1 : 0;
+}
+
+JSValue JS_GetModuleException(JSContext *ctx, JSModuleDef *m)
+{
+    if (!m->eval_has_exception)
+        return JS_UNDEFINED;
+    return JS_DupValue(ctx, m->eval_exception);
+}
+
+int JS_GetModuleRequestsLength(JSModuleDef *m)
+{
+    return m->req_module_entries_count;
+}
+
+JSAtom JS_GetModuleRequest(JSModuleDef *m, int i)
+{
+    return m->req_module_entries[i].module_name;
+}
+
+JSValue JS_GET_MODULE_NS(JSContext *ctx, JSModuleDef *m)
+{
+    return js_get_module_ns(ctx, m);
+}
+
+/* zero filled ArrayBuffer. With the default allocator large buffers
+   come from calloc() so that they get fresh zero pages instead of being
+   cleared by hand. Small ones stay on malloc() which is faster there. */
+#define JS_ARRAY_BUFFER_CALLOC_THRESHOLD (64 * 1024)
+
+JSValue JS_NewArrayBufferZeroed(JSContext *ctx, size_t len)
+{
+    JSRuntime *rt = ctx->rt;
+    JSMallocState *s = &rt->malloc_state;
+    size_t size = max_int(len, 1);
+    uint8_t *buf;
+    JSValue obj;
+
+    if (rt->ab_funcs.ab_alloc) {
+        return js_array_buffer_constructor3(ctx, JS_UNDEFINED, len,
+                                            JS_CLASS_ARRAY_BUFFER, NULL,
+                                            js_array_buffer_free, NULL, TRUE);
+    }
+    if (len > INT32_MAX)
+        return JS_ThrowRangeError(ctx, "invalid array buffer length");
+    if (size >= JS_ARRAY_BUFFER_CALLOC_THRESHOLD &&
+        rt->mf.js_malloc == js_def_malloc) {
+        /* same accounting as js_def_malloc() so that js_def_free() matches */
+        if (unlikely(s->malloc_size + size > s->malloc_limit))
+            return JS_ThrowOutOfMemory(ctx);
+        buf = calloc(1, size);
+        if (!buf)
+            return JS_ThrowOutOfMemory(ctx);
+        s->malloc_count++;
+        s->malloc_size += js_def_malloc_usable_size(buf) + MALLOC_OVERHEAD;
+    } else {
+        buf = js_mallocz(ctx, size);
+        if (!buf)
+            return JS_EXCEPTION;
+    }
+    obj = js_array_buffer_constructor3(ctx, JS_UNDEFINED, len,
+                                       JS_CLASS_ARRAY_BUFFER, buf,
+                                       js_array_buffer_free, NULL, FALSE);
+    if (JS_IsException(obj))
+        js_free_rt(rt, buf);
+    return obj;
+}
+
+void JS_SetArrayBufferFunctions(JSRuntime *rt, const JSArrayBufferFunctions *af)
+{
+    rt->ab_funcs = *af;
+}
+
+/* NULL if 'obj' is not a non shared ArrayBuffer or has no free_func */
+JSFreeArrayBufferDataFunc *JS_GetArrayBufferFreeFunc(JSValueConst obj, void **popaque)
+{
+    JSArrayBuffer *abuf = JS_GetOpaque(obj, JS_CLASS_ARRAY_BUFFER);
+    if (!abuf || abuf->detached)
+        return NULL;
+    *popaque = abuf->opaque;
+    return abuf->free_func;
+}
+
+/* Let 'free_func' release the storage of an ArrayBuffer from now on.
+   Return how the caller has to release it (JS_ARRAY_BUFFER_STORAGE_xxx)
+   or -1 if 'obj' is not a non shared ArrayBuffer or if out of memory. The
+   storage may outlive the runtime: JS heap storage leaves the runtime
+   accounting when the default allocator is used, and any other storage
+   owned by the runtime is first moved to a calloc() block. */
+int JS_SetArrayBufferFreeFunc(JSContext *ctx, JSValueConst obj,
+                              JSFreeArrayBufferDataFunc *free_func, void *opaque,
+                              JSFreeArrayBufferDataFunc **pold_func, void **pold_opaque)
+{
+    JSRuntime *rt = ctx->rt;
+    JSArrayBuffer *abuf = JS_GetOpaque(obj, JS_CLASS_ARRAY_BUFFER);
+    int kind;
+
+    if (!abuf || abuf->detached)
+        return -1;
+    *pold_func = abuf->free_func;
+    *pold_opaque = abuf->opaque;
+    if (!abuf->free_func) {
+        kind = JS_ARRAY_BUFFER_STORAGE_NONE;
+    } else if (abuf->free_func == js_array_buffer_ab_free) {
+        kind = JS_ARRAY_BUFFER_STORAGE_ALLOCATOR;
+    } else if (abuf->free_func == js_array_buffer_free &&
+               rt->mf.js_malloc == js_def_malloc) {
+        rt->malloc_state.malloc_count--;
+        rt->malloc_state.malloc_size -=
+            js_def_malloc_usable_size(abuf->data) + MALLOC_OVERHEAD;
+        kind = JS_ARRAY_BUFFER_STORAGE_MALLOC;
+    } else {
+        /* custom malloc functions, slab allocator or foreign free_func:
+           releasing the storage needs the runtime, so copy it out */
+        struct list_head *el;
+        uint8_t *data;
+
+        data = calloc(1, max_int(abuf->byte_length, 1));
+        if (!data)
+            return -1;
+        memcpy(data, abuf->data, abuf->byte_length);
+        abuf->free_func(rt, abuf->opaque, abuf->data);
+        abuf->data = data;
+        list_for_each(el, &abuf->array_list) {
+            JSTypedArray *ta;
+            JSObject *p;
+
+            ta = list_entry(el, JSTypedArray, link);
+            p = ta->obj;
+            if (p->class_id != JS_CLASS_DATAVIEW)
+                p->u.array.u.ptr = data + ta->offset;
+        }
+        kind = JS_ARRAY_BUFFER_STORAGE_MALLOC;
+    }
+    abuf->free_func = free_func;
+    abuf->opaque = opaque;
+    return kind;
+}
+
+/* class ids indexed by JS_TYPED_ARRAY_xxx, 0 if not compiled in */
+static const uint16_t js_typed_array_kind_class_id[JS_TYPED_ARRAY_DATAVIEW + 1] = {
+    JS_CLASS_UINT8C_ARRAY,
+    JS_CLASS_INT8_ARRAY,
+    JS_CLASS_UINT8_ARRAY,
+    JS_CLASS_INT16_ARRAY,
+    JS_CLASS_UINT16_ARRAY,
+    JS_CLASS_INT32_ARRAY,
+    JS_CLASS_UINT32_ARRAY,
+#ifdef CONFIG_BIGNUM
+    JS_CLASS_BIG_INT64_ARRAY,
+    JS_CLASS_BIG_UINT64_ARRAY,
+#else
+    0,
+    0,
+#endif
+    JS_CLASS_FLOAT32_ARRAY,
+    JS_CLASS_FLOAT64_ARRAY,
+    JS_CLASS_DATAVIEW,
+};
+
+/* JS_TYPED_ARRAY_xxx or -1 if 'obj' is not an ArrayBufferView */
+int JS_GetArrayBufferViewKind(JSValueConst obj)
+{
+    JSObject *p;
+    int i;
+
+    if (JS_VALUE_GET_TAG(obj) != JS_TAG_OBJECT)
+        return -1;
+    p = JS_VALUE_GET_OBJ(obj);
+    if (p->class_id < JS_CLASS_UINT8C_ARRAY || p->class_id > JS_CLASS_DATAVIEW)
+        return -1;
+    for (i = 0; i <= JS_TYPED_ARRAY_DATAVIEW; i++) {
+        if (js_typed_array_kind_class_id[i] == p->class_id)
+            return i;
+    }
+    return -1;
+}
+
+/* data pointer and length in bytes of an ArrayBuffer or SharedArrayBuffer.
+   Unlike JS_GetArrayBuffer() nothing is thrown: a detached buffer has a
+   NULL data pointer and a zero length. Return FALSE if 'obj' is not a
+   buffer. */
+JS_BOOL JS_GetArrayBufferData(JSValueConst obj, uint8_t **pdata, size_t *pbyte_length)
+{
+    JSObject *p;
+    JSArrayBuffer *abuf;
+
+    if (JS_VALUE_GET_TAG(obj) != JS_TAG_OBJECT)
+        return FALSE;
+    p = JS_VALUE_GET_OBJ(obj);
+    if (p->class_id != JS_CLASS_ARRAY_BUFFER &&
+        p->class_id != JS_CLASS_SHARED_ARRAY_BUFFER)
+        return FALSE;
+    abuf = p->u.array_buffer;
+    if (abuf->detached) {
+        *pdata = NULL;
+        *pbyte_length = 0;
+    } else {
+        *pdata = abuf->data;
+        *pbyte_length = abuf->byte_length;
+    }
+    return TRUE;
+}
+
+/* data pointer (start of the view), offset, length in bytes and element
+   type of an ArrayBufferView in one call. A detached view has a NULL data
+   pointer and a zero length. Return FALSE if 'obj' is not a view. */
+JS_BOOL JS_GetArrayBufferViewData(JSValueConst obj, uint8_t **pdata, size_t *pbyte_offset,
+                                  size_t *pbyte_length, int *pkind)
+{
+    JSTypedArray *ta;
+    JSArrayBuffer *abuf;
+    int kind;
+
+    kind = JS_GetArrayBufferViewKind(obj);
+    if (kind < 0)
+        return FALSE;
+    ta = JS_VALUE_GET_OBJ(obj)->u.typed_array;
+    abuf = ta->buffer->u.array_buffer;
+    if (abuf->detached) {
+        *pdata = NULL;
+        *pbyte_offset = 0;
+        *pbyte_length = 0;
+    } else {
+        *pdata = abuf->data + ta->offset;
+        *pbyte_offset = ta->offset;
+        *pbyte_length = ta->length;
+    }
+    if (pkind)
+        *pkind = kind;
+    return TRUE;
+}
+
+/* typed array of 'length' elements over 'buffer' (ArrayBuffer or
+   SharedArrayBuffer) */
+JSValue JS_NewTypedArrayWithBuffer(JSContext *ctx, JSValueConst buffer,
+                                   size_t byte_offset, size_t length, int kind)
+{
+    JSValue args[3];
+    JSValue ret;
+
+    if (kind < 0 || kind > JS_TYPED_ARRAY_FLOAT64 ||
+        !js_typed_array_kind_class_id[kind])
+        return JS_ThrowTypeError(ctx, "unsupported typed array type");
+    if (JS_VALUE_GET_TAG(buffer) != JS_TAG_OBJECT ||
+        (JS_VALUE_GET_OBJ(buffer)->class_id != JS_CLASS_ARRAY_BUFFER &&
+         JS_VALUE_GET_OBJ(buffer)->class_id != JS_CLASS_SHARED_ARRAY_BUFFER))
+        return JS_ThrowTypeError(ctx, "not an ArrayBuffer");
+    args[0] = buffer;
+    args[1] = JS_NewInt64(ctx, byte_offset);
+    args[2] = JS_NewInt64(ctx, length);
+    ret = js_typed_array_constructor(ctx, JS_UNDEFINED, 3, args,
+                                     js_typed_array_kind_class_id[kind]);
+    JS_FreeValue(ctx, args[1]);
+    JS_FreeValue(ctx, args[2]);
+    return ret;
+}
+
+/* frames of the current stack, most recent first */
+JSBacktrace *JS_CaptureBacktrace(JSContext *ctx, int max_frames)
+{
+    if (max_frames < 0)
+        max_frames = 0;
+    return js_capture_backtrace(ctx, NULL, -1, 0, max_frames);
+}
+
+JSBacktrace *JS_DupBacktrace(JSBacktrace *bt)
+{
+    bt->ref_count++;
+    return bt;
+}
+
+/* frames captured when 'obj' was created, also after its 'stack'
+   property has been formatted. Return NULL if there are none. */
+JSBacktrace *JS_GetErrorBacktrace(JSRuntime *rt, JSValueConst obj)
+{
+    JSObject *p;
+    JSProperty *pr;
+    JSShapeProperty *prs;
+
+    if (JS_VALUE_GET_TAG(obj) != JS_TAG_OBJECT)
+        return NULL;
+    p = JS_VALUE_GET_OBJ(obj);
+    prs = find_own_property(&pr, p, JS_ATOM_stack);
+    if (prs && (prs->flags & JS_PROP_TMASK) == JS_PROP_AUTOINIT &&
+        js_autoinit_get_id(pr) == JS_AUTOINIT_ID_BACKTRACE)
+        return JS_DupBacktrace(pr->u.init.opaque);
+    if (p->class_id == JS_CLASS_ERROR && p->u.backtrace)
+        return JS_DupBacktrace(p->u.backtrace);
+    return NULL;
+}
+
+void JS_FreeBacktrace(JSRuntime *rt, JSBacktrace *bt)
+{
+    js_backtrace_free(rt, bt);
+}
+
+int JS_GetBacktraceFrameCount(JSBacktrace *bt)
+{
+    return bt->frame_count;
+}
+
+JS_BOOL JS_IsBacktraceFrameNative(JSBacktrace *bt, int i)
+{
+    return bt->frames[i].b == NULL;
+}
+
+/* The frame getters below only need the runtime so that they can be
+   used when no context is current. */
+
+/* function name or JS_UNDEFINED if the function is anonymous */
+JSValue JS_GetBacktraceFrameFunctionName(JSRuntime *rt, JSBacktrace *bt, int i)
+{
+    return JS_DupValueRT(rt, bt->frames[i].func_name);
+}
+
+/* script name or JS_UNDEFINED for native functions, stripped bytecode
+   and when out of memory */
+JSValue JS_GetBacktraceFrameScriptName(JSRuntime *rt, JSBacktrace *bt, int i)
+{
+    JSFunctionBytecode *b = bt->frames[i].b;
+    JSAtom atom;
+    JSString *str;
+    char buf[ATOM_GET_STR_BUF_SIZE];
+    int len;
+
+    if (!b || !b->has_debug)
+        return JS_UNDEFINED;
+    atom = b->debug.filename;
+    if (!__JS_AtomIsTaggedInt(atom))
+        return JS_DupValueRT(rt, JS_MKPTR(JS_TAG_STRING, rt->atom_array[atom]));
+    /* numeric file names are stored as integer atoms */
+    len = snprintf(buf, sizeof(buf), "%u", __JS_AtomToUInt32(atom));
+    str = js_alloc_string_rt(rt, len, 0);
+    if (!str)
+        return JS_UNDEFINED;
+    memcpy(str->u.str8, buf, len + 1);
+    return JS_MKPTR(JS_TAG_STRING, str);
+}
+
+/* 1 based line number or -1 if unknown */
+int JS_GetBacktraceFrameLineNumber(JSRuntime *rt, JSBacktrace *bt, int i)
+{
+    JSFunctionBytecode *b = bt->frames[i].b;
+
+    if (!b || !b->has_debug)
+        return -1;
+    /* find_line_num() does not use the context */
+    return find_line_num(NULL, b, bt->frames[i].pc);
+}
+
+/* text of the current line of the frame if the function source was kept,
+   JS_UNDEFINED otherwise */
+JSValue JS_GetBacktraceFrameSourceLine(JSContext *ctx, JSBacktrace *bt, int i)
+{
+    JSFunctionBytecode *b = bt->frames[i].b;
+    const char *p, *p_end, *line_end;
+    int line;
+
+    if (!b || !b->has_debug || !b->debug.source)
+        return JS_UNDEFINED;
+    line = find_line_num(ctx, b, bt->frames[i].pc);
+    if (line < b->debug.line_num)
+        return JS_UNDEFINED;
+    p = b->debug.source;
+    p_end = p + b->debug.source_len;
+    for (line -= b->debug.line_num; line > 0; line--) {
+        p = memchr(p, '\n', p_end - p);
+        if (!p)
+            return JS_UNDEFINED;
+        p++;
+    }
+    line_end = memchr(p, '\n', p_end - p);
+    if (!line_end)
+        line_end = p_end;
+    return JS_NewStringLen(ctx, p, line_end - p);
+}
+/* address of the pending exception of 'rt'. It holds JS_UNINITIALIZED
+   while no exception is pending (null and undefined are valid values to
+   throw), so it can be tested without a function call. */
+const JSValue *JS_GetPendingExceptionSlot(JSRuntime *rt)
+{
+    return &rt->current_exception;
+}
+
+/* innermost stack frame, NULL when no function is running. Only meant to
+   be compared with a previous result. */
+void *JS_GetCurrentStackFrame(JSRuntime *rt)
+{
+    return rt->current_stack_frame;
+}
+/* occupancy of the size classes of the slab allocator. Return the number
+   of classes, 0 if 'rt' does not use it. At most 'max_classes' entries
+   of 'stats' are filled. */
+int JS_GetSlabStats(JSRuntime *rt, JSSlabClassStats *stats, int max_classes)
+{
+#ifdef CONFIG_SLAB_ALLOCATOR
+    JSSlabAllocator *sa;
+    JSSlabClass *cls;
+    int i;
+
+    if (rt->mf.js_malloc != js_slab_malloc)
+        return 0;
+    sa = rt->malloc_state.opaque;
+    for(i = 0; i < JS_SLAB_CLASS_COUNT && i < max_classes; i++) {
+        cls = &sa->classes[i];
+        stats[i].block_size = cls->size;
+        stats[i].slab_count = cls->slab_count;
+        stats[i].used_count = cls->used_count;
+        stats[i].capacity = (size_t)cls->slab_count * cls->capacity;
+    }
+    return JS_SLAB_CLASS_COUNT;
+#else
+    return 0;
+#endif
+}
+/* allocation counters of 'rt', without walking the heap */
+void JS_GetMallocState(JSRuntime *rt, JSMallocState *s)
+{
+    *s = rt->malloc_state;
+}
+
+int JS_GetContextCount(JSRuntime *rt)
+{
+    struct list_head *el;
+    int n = 0;
+
+    list_for_each(el, &rt->context_list) {
+        n++;
+    }
+    return n;
+}
+
 /*-------end fuctions for v8 api---------*/
@@ -307,6 +307,9 @@ static inline JS_BOOL JS_VALUE_IS_NAN(JSValue v)
 #define JS_EVAL_FLAG_COMPILE_ONLY (1 << 5)
 /* don't include the stack frames before this eval in the Error() backtraces */
 #define JS_EVAL_FLAG_BACKTRACE_BARRIER (1 << 6)
+/* modules: don't resolve the imports at compile time, use
+   JS_InstantiateModule() later */
+#define JS_EVAL_FLAG_NO_RESOLVE (1 << 7)
 
 typedef JSValue JSCFunction(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv);
 typedef JSValue JSCFunctionMagic(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv, int magic);
@@ -406,6 +409,9 @@ typedef struct JSMemoryUsage {
     int64_t c_func_count, array_count;
     int64_t fast_array_count, fast_array_elements;
     int64_t binary_object_count, binary_object_size;
+    /* ArrayBuffer and SharedArrayBuffer objects, the bytes they hold are
+       also part of memory_used_size */
+    int64_t array_buffer_count, array_buffer_size;
 } JSMemoryUsage;
 
 void JS_ComputeMemoryUsage(JSRuntime *rt, JSMemoryUsage *s);
@@ -826,6 +832,38 @@ typedef struct {
 } JSSharedArrayBufferFunctions;
 void JS_SetSharedArrayBufferFunctions(JSRuntime *rt,
                                       const JSSharedArrayBufferFunctions *sf);
+typedef struct {
+    /* 'zeroed' is FALSE when the caller fills the whole buffer itself */
+    void *(*ab_alloc)(void *opaque, size_t size, JS_BOOL zeroed);
+    void (*ab_free)(void *opaque, void *ptr, size_t size);
+    void *ab_opaque;
+} JSArrayBufferFunctions;
+/* who releases the storage handed over by JS_SetArrayBufferFreeFunc() */
+#define JS_ARRAY_BUFFER_STORAGE_NONE      0 /* nobody, owned by the embedder */
+#define JS_ARRAY_BUFFER_STORAGE_MALLOC    1 /* release with free() */
+#define JS_ARRAY_BUFFER_STORAGE_ALLOCATOR 2 /* release with ab_funcs.ab_free() */
+/* element types of the views seen by JS_GetArrayBufferViewData() */
+#define JS_TYPED_ARRAY_UINT8C    0
+#define JS_TYPED_ARRAY_INT8      1
+#define JS_TYPED_ARRAY_UINT8     2
+#define JS_TYPED_ARRAY_INT16     3
+#define JS_TYPED_ARRAY_UINT16    4
+#define JS_TYPED_ARRAY_INT32     5
+#define JS_TYPED_ARRAY_UINT32    6
+#define JS_TYPED_ARRAY_BIGINT64  7
+#define JS_TYPED_ARRAY_BIGUINT64 8
+#define JS_TYPED_ARRAY_FLOAT32   9
+#define JS_TYPED_ARRAY_FLOAT64   10
+#define JS_TYPED_ARRAY_DATAVIEW  11
+/* stack frames captured for an Error, see JS_GetErrorBacktrace() */
+typedef struct JSBacktrace JSBacktrace;
+/* occupancy of one size class of the slab allocator, see JS_GetSlabStats() */
+typedef struct JSSlabClassStats {
+    size_t block_size; /* payload bytes of a block */
+    size_t slab_count;
+    size_t used_count; /* blocks in use */
+    size_t capacity; /* blocks in all the slabs of the class */
+} JSSlabClassStats;
 
 JSValue JS_NewPromiseCapability(JSContext *ctx, JSValue *resolving_funcs);
 
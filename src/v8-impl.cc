@@ -1,6 +1,10 @@
 #include "v8.h"
 #include<cstring>
 #include <algorithm>
+#include <iterator>
+#include <cstdlib>
+#include <chrono>
+#include <mutex>
 
 enum
 {
@@ -34,7 +38,8 @@ namespace v8 {
 
 Maybe<uint32_t> Value::Uint32Value(Local<Context> context) const {
     double d;
-    if (JS_ToFloat64(Isolate::current_->current_context_->context_, &d, value_)) {
+    if (JS_ToFloat64(Isolate::GetCurrent()->current_context_->context_, &d, value_)) {
+        Isolate::GetCurrent()->handleException();
         return Maybe<uint32_t>();
     }
     else {
@@ -44,7 +49,8 @@ Maybe<uint32_t> Value::Uint32Value(Local<Context> context) const {
     
 Maybe<int32_t> Value::Int32Value(Local<Context> context) const {
     double d;
-    if (JS_ToFloat64(Isolate::current_->current_context_->context_, &d, value_)) {
+    if (JS_ToFloat64(Isolate::GetCurrent()->current_context_->context_, &d, value_)) {
+        Isolate::GetCurrent()->handleException();
         return Maybe<int32_t>();
     }
     else {
@@ -73,7 +79,7 @@ bool Value::IsSymbol() const {
 }
 
 Isolate* Promise::GetIsolate() {
-    return Isolate::current_;
+    return Isolate::GetCurrent();
 }
 
 void V8FinalizerWrap(JSRuntime *rt, JSValue val) {
@@ -89,12 +95,114 @@ void V8FinalizerWrap(JSRuntime *rt, JSValue val) {
     }
 }
 
+//FunctionTemplate::GetFunction生成的函数通过一个该class的对象持有CFunctionData，对象释放时一并释放
+static void CFunctionDataFinalizer(JSRuntime *rt, JSValue val) {
+    Isolate* isolate = (Isolate*)JS_GetRuntimeOpaque(rt);
+    FunctionTemplate::CFunctionData* cdata = reinterpret_cast<FunctionTemplate::CFunctionData*>(JS_GetOpaque(val, isolate->function_data_class_id_));
+    if (cdata) {
+        JS_FreeValueRT(rt, cdata->data_);
+        js_free_rt(rt, cdata);
+    }
+}
+
+static void CFunctionDataMark(JSRuntime *rt, JSValueConst val, JS_MarkFunc *mark_func) {
+    Isolate* isolate = (Isolate*)JS_GetRuntimeOpaque(rt);
+    FunctionTemplate::CFunctionData* cdata = reinterpret_cast<FunctionTemplate::CFunctionData*>(JS_GetOpaque(val, isolate->function_data_class_id_));
+    if (cdata) {
+        JS_MarkValue(rt, cdata->data_, mark_func);
+    }
+}
+
+//ObjectTemplate::SetAccessor生成的getter/setter通过一个该class的对象共享AccessorData
+static void AccessorDataFinalizer(JSRuntime *rt, JSValue val) {
+    Isolate* isolate = (Isolate*)JS_GetRuntimeOpaque(rt);
+    ObjectTemplate::AccessorData* accessor = reinterpret_cast<ObjectTemplate::AccessorData*>(JS_GetOpaque(val, isolate->accessor_data_class_id_));
+    if (accessor) {
+        JS_FreeValueRT(rt, accessor->data_);
+        JS_FreeValueRT(rt, accessor->name_);
+        js_free_rt(rt, accessor);
+    }
+}
+
+static void AccessorDataMark(JSRuntime *rt, JSValueConst val, JS_MarkFunc *mark_func) {
+    Isolate* isolate = (Isolate*)JS_GetRuntimeOpaque(rt);
+    ObjectTemplate::AccessorData* accessor = reinterpret_cast<ObjectTemplate::AccessorData*>(JS_GetOpaque(val, isolate->accessor_data_class_id_));
+    if (accessor) {
+        JS_MarkValue(rt, accessor->data_, mark_func);
+    }
+}
+
+static char* ModuleNormalize(JSContext* ctx, const char* base_name, const char* specifier, void* opaque);
+
+//SharedArrayBuffer的内存按数据地址登记，所有isolate共用这张表
+//count_是引用这块内存的SharedArrayBuffer对象数（不分isolate），归零时放掉store_
+struct SharedMemoryEntry {
+    std::shared_ptr<BackingStore> store_;
+    size_t count_ = 0;
+};
+
+static std::mutex shared_memory_mutex;
+
+static std::unordered_map<void*, SharedMemoryEntry> shared_memory_entries;
+
+static void SharedMemoryRegister(const std::shared_ptr<BackingStore>& store) {
+    std::lock_guard<std::mutex> lock(shared_memory_mutex);
+    SharedMemoryEntry& entry = shared_memory_entries[store->Data()];
+    if (!entry.store_) {
+        entry.store_ = store;
+    }
+    entry.count_++;
+}
+
+//js里new SharedArrayBuffer走这里，quickjs随后会清零
+static void* SharedMemoryAlloc(void* opaque, size_t size) {
+    void* data = malloc(size);
+    if (!data) {
+        return nullptr;
+    }
+    std::shared_ptr<BackingStore> store(SharedArrayBuffer::NewBackingStore(data, size, [](void* data, size_t length, void* deleter_data) {
+        free(data);
+    }, nullptr));
+    SharedMemoryRegister(store);
+    return data;
+}
+
+static void SharedMemoryDup(void* opaque, void* ptr) {
+    std::lock_guard<std::mutex> lock(shared_memory_mutex);
+    shared_memory_entries[ptr].count_++;
+}
+
+static void SharedMemoryFree(void* opaque, void* ptr) {
+    std::shared_ptr<BackingStore> released;
+    {
+        std::lock_guard<std::mutex> lock(shared_memory_mutex);
+        auto iter = shared_memory_entries.find(ptr);
+        if (iter == shared_memory_entries.end()) {
+            return;
+        }
+        if (--iter->second.count_ == 0) {
+            released = std::move(iter->second.store_);
+            shared_memory_entries.erase(iter);
+        }
+    }
+    //deleter可能比较慢，放到锁外面执行
+}
+
+static std::shared_ptr<BackingStore> SharedMemoryFind(void* ptr) {
+    std::lock_guard<std::mutex> lock(shared_memory_mutex);
+    auto iter = shared_memory_entries.find(ptr);
+    return iter == shared_memory_entries.end() ? nullptr : iter->second.store_;
+}
+
 Isolate::Isolate() : Isolate(nullptr) {
 }
 
-Isolate::Isolate(void* external_runtime) : current_context_(nullptr) {
-    is_external_runtime_ = external_runtime != nullptr;
-    runtime_ = is_external_runtime_ ? ((JSRuntime *)external_runtime) : JS_NewRuntime();
+Isolate::Isolate(void* external_runtime) : Isolate(external_runtime ? (JSRuntime *)external_runtime : JS_NewRuntime(), external_runtime != nullptr) {
+}
+
+Isolate::Isolate(JSRuntime* runtime, bool is_external_runtime) : current_context_(nullptr) {
+    is_external_runtime_ = is_external_runtime;
+    runtime_ = runtime;
     JS_SetRuntimeOpaque(runtime_, this);
     literal_values_[kUndefinedValueIndex] = JS_Undefined();
     literal_values_[kNullValueIndex] = JS_Null();
@@ -102,7 +210,7 @@ Isolate::Isolate(void* external_runtime) : current_context_(nullptr) {
     literal_values_[kFalseValueIndex] = JS_False();
     literal_values_[kEmptyStringIndex] = JS_Undefined();
     
-    exception_ = JS_Undefined();
+    pending_exception_ = JS_GetPendingExceptionSlot(runtime_);
     
     JSClassDef cls_def;
     cls_def.class_name = "__v8_simulate_obj";
@@ -115,35 +223,126 @@ Isolate::Isolate(void* external_runtime) : current_context_(nullptr) {
     //后续如果用这个class_id新建对象，如果class_id大于uint16_t将会被截值，后续释放对象时，会找错class，可能会导致严重后果（不释放，或者调用错误的free）
     class_id_ = 0;
     JS_NewClassID(&class_id_);
+    
+    //外部传入的runtime可能已经设置了自己的模块加载器
+    if (!is_external_runtime_) {
+        JS_SetModuleLoaderFunc(runtime_, ModuleNormalize, nullptr, this);
+        JSSharedArrayBufferFunctions sab_funcs;
+        sab_funcs.sab_alloc = SharedMemoryAlloc;
+        sab_funcs.sab_free = SharedMemoryFree;
+        sab_funcs.sab_dup = SharedMemoryDup;
+        sab_funcs.sab_opaque = nullptr;
+        JS_SetSharedArrayBufferFunctions(runtime_, &sab_funcs);
+    }
     JS_NewClass(runtime_, class_id_, &cls_def);
+    
+    JSClassDef function_data_def;
+    function_data_def.class_name = "__v8_function_data";
+    function_data_def.finalizer = CFunctionDataFinalizer;
+    function_data_def.exotic = NULL;
+    function_data_def.gc_mark = CFunctionDataMark;
+    function_data_def.call = NULL;
+    
+    function_data_class_id_ = 0;
+    JS_NewClassID(&function_data_class_id_);
+    JS_NewClass(runtime_, function_data_class_id_, &function_data_def);
+    
+    JSClassDef accessor_data_def;
+    accessor_data_def.class_name = "__v8_accessor_data";
+    accessor_data_def.finalizer = AccessorDataFinalizer;
+    accessor_data_def.exotic = NULL;
+    accessor_data_def.gc_mark = AccessorDataMark;
+    accessor_data_def.call = NULL;
+    
+    accessor_data_class_id_ = 0;
+    JS_NewClassID(&accessor_data_class_id_);
+    JS_NewClass(runtime_, accessor_data_class_id_, &accessor_data_def);
 };
 
+static void* ArrayBufferAlloc(void* opaque, size_t size, JS_BOOL zeroed) {
+    Isolate* isolate = reinterpret_cast<Isolate*>(opaque);
+    void* data = zeroed ? isolate->array_buffer_allocator_->Allocate(size) :
+        isolate->array_buffer_allocator_->AllocateUninitialized(size);
+    if (data) {
+        isolate->array_buffer_allocated_bytes_ += size;
+    }
+    return data;
+}
+
+static void ArrayBufferFree(void* opaque, void* ptr, size_t size) {
+    Isolate* isolate = reinterpret_cast<Isolate*>(opaque);
+    isolate->array_buffer_allocator_->Free(ptr, size);
+    isolate->array_buffer_allocated_bytes_ -= size;
+}
+
+static JSRuntime* NewRuntime(const Isolate::CreateParams& params) {
+    if (params.malloc_functions) {
+        return JS_NewRuntime2(params.malloc_functions, params.malloc_opaque);
+    }
+    return JS_NewRuntime();
+}
+
+Isolate::Isolate(const CreateParams& params) : Isolate(NewRuntime(params), false) {
+    array_buffer_allocator_ = params.array_buffer_allocator;
+    if (array_buffer_allocator_) {
+        JSArrayBufferFunctions funcs;
+        funcs.ab_alloc = ArrayBufferAlloc;
+        funcs.ab_free = ArrayBufferFree;
+        funcs.ab_opaque = this;
+        JS_SetArrayBufferFunctions(runtime_, &funcs);
+    }
+}
+
 Isolate::~Isolate() {
-    for (size_t i = 0; i < values_.size(); i++) {
-        delete values_[i];
+    //这些对象由Local共享持有，可能比Isolate活得久，先放掉它们在runtime里的引用
+    while (!messages_.empty()) {
+        messages_.back()->Detach();
+    }
+    while (!stack_traces_.empty()) {
+        stack_traces_.back()->Detach();
+    }
+    while (!stack_frames_.empty()) {
+        stack_frames_.back()->Detach();
+    }
+    for (size_t i = 0; i < handle_blocks_.size(); i++) {
+        delete[] handle_blocks_[i];
     }
-    values_.clear();
+    handle_blocks_.clear();
+    handle_next_ = handle_limit_ = nullptr;
     JS_FreeValueRT(runtime_, literal_values_[kEmptyStringIndex]);
     if (!is_external_runtime_) {
         JS_FreeRuntime(runtime_);
     }
+    for (size_t i = 0; i < template_chains_.size(); i++) {
+        delete[] template_chains_[i];
+    }
+    template_chains_.clear();
 };
 
-Value* Isolate::Alloc_() {
-    if (value_alloc_pos_ == (int)values_.size()) {
-        JSValue* node = new JSValue;
-        *node = JS_Undefined();
-        values_.push_back(node);
+//只在当前块用完时进来，此时value_alloc_pos_必然在块边界上
+void Isolate::NextHandleBlock_() {
+    size_t block = value_alloc_pos_ / kHandleBlockSize;
+    if (block == handle_blocks_.size()) {
+        JSValue* values = new JSValue[kHandleBlockSize];
+        for (int i = 0; i < kHandleBlockSize; i++) {
+            values[i] = JS_Undefined();
+        }
+        handle_blocks_.push_back(values);
     }
-    auto ret = reinterpret_cast<Value*>(values_[value_alloc_pos_++]);
-    return ret;
+    handle_next_ = handle_blocks_[block];
+    handle_limit_ = handle_next_ + kHandleBlockSize;
 }
 
-void Isolate::ForeachAllocValue(int start, int end, std::function<void(JSValue*, int)> callback) {
-    for (int i = std::min(end, value_alloc_pos_) ; i > std::max(0, start); i--) {
-        int idx = i - 1;
-        JSValue * to_free = values_[idx];
-        callback(to_free, idx);
+void Isolate::SetAllocPos(int pos) {
+    value_alloc_pos_ = pos;
+    int offset = pos % kHandleBlockSize;
+    if (offset == 0) {
+        //交给NextHandleBlock_定位，避免引用还没分配的块
+        handle_next_ = handle_limit_ = nullptr;
+    } else {
+        JSValue* block = handle_blocks_[pos / kHandleBlockSize];
+        handle_next_ = block + offset;
+        handle_limit_ = block + kHandleBlockSize;
     }
 }
 
@@ -152,23 +351,21 @@ void Isolate::Escape(JSValue* val) {
     currentHandleScope->Escape_(val);
 }
 
-Isolate* Isolate::current_ = nullptr;
+#if defined(V8_OS_WIN) && (defined(BUILDING_V8_SHARED) || defined(USING_V8_SHARED))
+Isolate*& Isolate::CurrentSlot() {
+    static thread_local Isolate* current = nullptr;
+    return current;
+}
+#endif
 
-void Isolate::handleException() {
-    if (currentTryCatch_) {
-        currentTryCatch_->handleException();
-        return;
-    }
-    
-    JSValue ex = JS_GetException(current_context_->context_);
-    
+static void PrintUncaughtException(JSContext* ctx, JSValue ex) {
     if (!JS_IsUndefined(ex) && !JS_IsNull(ex)) {
-        JSValue fileNameVal = JS_GetProperty(current_context_->context_, ex, JS_ATOM_fileName);
-        JSValue lineNumVal = JS_GetProperty(current_context_->context_, ex, JS_ATOM_lineNumber);
+        JSValue fileNameVal = JS_GetProperty(ctx, ex, JS_ATOM_fileName);
+        JSValue lineNumVal = JS_GetProperty(ctx, ex, JS_ATOM_lineNumber);
         
-        auto msg = JS_ToCString(current_context_->context_, ex);
-        auto fileName = JS_ToCString(current_context_->context_, fileNameVal);
-        auto lineNum = JS_ToCString(current_context_->context_, lineNumVal);
+        auto msg = JS_ToCString(ctx, ex);
+        auto fileName = JS_ToCString(ctx, fileNameVal);
+        auto lineNum = JS_ToCString(ctx, lineNumVal);
         if (JS_IsUndefined(fileNameVal)) {
             std::cerr << "Uncaught " << msg << std::endl;
         }
@@ -176,15 +373,30 @@ void Isolate::handleException() {
             std::cerr << fileName << ":" << lineNum << ": Uncaught " << msg << std::endl;
         }
         
-        JS_FreeCString(current_context_->context_, lineNum);
-        JS_FreeCString(current_context_->context_, fileName);
-        JS_FreeCString(current_context_->context_, msg);
+        JS_FreeCString(ctx, lineNum);
+        JS_FreeCString(ctx, fileName);
+        JS_FreeCString(ctx, msg);
         
-        JS_FreeValue(current_context_->context_, lineNumVal);
-        JS_FreeValue(current_context_->context_, fileNameVal);
-        
-        JS_FreeValue(current_context_->context_, ex);
+        JS_FreeValue(ctx, lineNumVal);
+        JS_FreeValue(ctx, fileNameVal);
+    }
+    JS_FreeValue(ctx, ex);
+}
+
+//异常已经挂在quickjs上，按v8的规则决定由谁处理：
+//1、最内层的TryCatch和当前是同一个js栈帧（中间没有进入过js），由它捕获
+//2、还在js调用的回调里，留在quickjs上，回调返回后继续抛给js
+//3、都不是则打印
+void Isolate::handleException() {
+    void* frame = JS_GetCurrentStackFrame(runtime_);
+    if (currentTryCatch_ && currentTryCatch_->stack_frame_ == frame) {
+        currentTryCatch_->handleException();
+        return;
+    }
+    if (frame) {
+        return;
     }
+    PrintUncaughtException(current_context_->context_, JS_GetException(current_context_->context_));
 }
 
 void Isolate::LowMemoryNotification() {
@@ -192,9 +404,162 @@ void Isolate::LowMemoryNotification() {
     JS_RunGC(runtime_);
 }
 
+HeapStatistics::HeapStatistics(): total_heap_size_(0), total_heap_size_executable_(0), total_physical_size_(0),
+    total_available_size_(0), total_global_handles_size_(0), used_global_handles_size_(0), used_heap_size_(0),
+    heap_size_limit_(0), malloced_memory_(0), external_memory_(0), peak_malloced_memory_(0),
+    number_of_native_contexts_(0), number_of_detached_contexts_(0), does_zap_garbage_(0) {
+}
+
+HeapSpaceStatistics::HeapSpaceStatistics(): space_name_(nullptr), space_size_(0), space_used_size_(0),
+    space_available_size_(0), physical_space_size_(0) {
+}
+
+HeapObjectStatistics::HeapObjectStatistics(): object_type_(nullptr), object_sub_type_(nullptr), object_count_(0),
+    object_size_(0) {
+}
+
+void Isolate::GetHeapStatistics(HeapStatistics* heap_statistics) {
+    JSMallocState malloc_state;
+    JS_GetMallocState(runtime_, &malloc_state);
+    
+    size_t limit = malloc_state.malloc_limit;
+    size_t used = malloc_state.malloc_size;
+    
+    heap_statistics->total_heap_size_ = used;
+    heap_statistics->total_physical_size_ = used;
+    heap_statistics->used_heap_size_ = used;
+    heap_statistics->malloced_memory_ = used;
+    //bytecode和普通对象在同一个分配器里，无法在不遍历堆的情况下区分
+    heap_statistics->total_heap_size_executable_ = 0;
+    //quickjs没记录峰值
+    heap_statistics->peak_malloced_memory_ = 0;
+    heap_statistics->heap_size_limit_ = limit;
+    //JS_SetMemoryLimit没设置时malloc_limit为(size_t)-1
+    heap_statistics->total_available_size_ = limit > used ? limit - used : 0;
+    heap_statistics->external_memory_ = array_buffer_allocated_bytes_;
+    heap_statistics->number_of_native_contexts_ = JS_GetContextCount(runtime_);
+    heap_statistics->number_of_detached_contexts_ = 0;
+    heap_statistics->total_global_handles_size_ = 0;
+    heap_statistics->used_global_handles_size_ = 0;
+    heap_statistics->does_zap_garbage_ = 0;
+}
+
+void Isolate::UpdateHeapSnapshot() {
+    JS_ComputeMemoryUsage(runtime_, &heap_snapshot_);
+    heap_snapshot_valid_ = true;
+}
+
+enum {
+    kObjectSpace,
+    kStringSpace,
+    kAtomSpace,
+    kShapeSpace,
+    kCodeSpace,
+    kArrayBufferSpace,
+    kHeapSpaceCount
+};
+
+size_t Isolate::NumberOfHeapSpaces() {
+    return kHeapSpaceCount;
+}
+
+bool Isolate::GetHeapSpaceStatistics(HeapSpaceStatistics* space_statistics, size_t index) {
+    if (index >= kHeapSpaceCount) {
+        return false;
+    }
+    
+    if (index == 0 || !heap_snapshot_valid_) {
+        UpdateHeapSnapshot();
+    }
+    
+    const JSMemoryUsage &u = heap_snapshot_;
+    int64_t size = 0;
+    switch (index) {
+        case kObjectSpace:
+            space_statistics->space_name_ = "object_space";
+            //fast array的元素单独分配，每个元素一个JSValue
+            size = u.obj_size + u.prop_size + u.fast_array_elements * (int64_t)sizeof(JSValue);
+            break;
+        case kStringSpace:
+            space_statistics->space_name_ = "string_space";
+            size = u.str_size;
+            break;
+        case kAtomSpace:
+            space_statistics->space_name_ = "atom_space";
+            size = u.atom_size;
+            break;
+        case kShapeSpace:
+            space_statistics->space_name_ = "shape_space";
+            size = u.shape_size;
+            break;
+        case kCodeSpace:
+            space_statistics->space_name_ = "code_space";
+            size = u.js_func_size + u.js_func_code_size + u.js_func_pc2line_size;
+            break;
+        case kArrayBufferSpace:
+            space_statistics->space_name_ = "array_buffer_space";
+            size = u.array_buffer_size;
+            break;
+    }
+    
+    space_statistics->space_size_ = (size_t)size;
+    space_statistics->space_used_size_ = (size_t)size;
+    space_statistics->physical_space_size_ = (size_t)size;
+    //不是预留式的空间，没有可用余量一说
+    space_statistics->space_available_size_ = 0;
+    return true;
+}
+
+struct HeapObjectTypeInfo {
+    const char* name;
+    int64_t JSMemoryUsage::*count;
+    int64_t JSMemoryUsage::*size;
+};
+
+//size为nullptr的类型quickjs只统计了个数
+static const HeapObjectTypeInfo kHeapObjectTypes[] = {
+    { "OBJECT", &JSMemoryUsage::obj_count, &JSMemoryUsage::obj_size },
+    { "PROPERTY", &JSMemoryUsage::prop_count, &JSMemoryUsage::prop_size },
+    { "STRING", &JSMemoryUsage::str_count, &JSMemoryUsage::str_size },
+    { "ATOM", &JSMemoryUsage::atom_count, &JSMemoryUsage::atom_size },
+    { "SHAPE", &JSMemoryUsage::shape_count, &JSMemoryUsage::shape_size },
+    { "JS_FUNCTION", &JSMemoryUsage::js_func_count, &JSMemoryUsage::js_func_size },
+    { "BYTECODE", &JSMemoryUsage::js_func_count, &JSMemoryUsage::js_func_code_size },
+    { "PC2LINE", &JSMemoryUsage::js_func_pc2line_count, &JSMemoryUsage::js_func_pc2line_size },
+    { "C_FUNCTION", &JSMemoryUsage::c_func_count, nullptr },
+    { "ARRAY", &JSMemoryUsage::array_count, nullptr },
+    { "FAST_ARRAY", &JSMemoryUsage::fast_array_count, nullptr },
+    { "BINARY_OBJECT", &JSMemoryUsage::binary_object_count, &JSMemoryUsage::binary_object_size },
+    { "ARRAY_BUFFER", &JSMemoryUsage::array_buffer_count, &JSMemoryUsage::array_buffer_size },
+};
+
+static const size_t kHeapObjectTypeCount = sizeof(kHeapObjectTypes) / sizeof(kHeapObjectTypes[0]);
+
+size_t Isolate::NumberOfTrackedHeapObjectTypes() {
+    return kHeapObjectTypeCount;
+}
+
+bool Isolate::GetHeapObjectStatisticsAtLastGC(HeapObjectStatistics* object_statistics, size_t type_index) {
+    if (type_index >= kHeapObjectTypeCount) {
+        return false;
+    }
+    
+    if (type_index == 0 || !heap_snapshot_valid_) {
+        UpdateHeapSnapshot();
+    }
+    
+    object_statistics->object_sub_type_ = "";
+    const HeapObjectTypeInfo &info = kHeapObjectTypes[type_index];
+    object_statistics->object_type_ = info.name;
+    object_statistics->object_count_ = (size_t)(heap_snapshot_.*info.count);
+    object_statistics->object_size_ = info.size ? (size_t)(heap_snapshot_.*info.size) : 0;
+    return true;
+}
+
 Local<Value> Isolate::ThrowException(Local<Value> exception) {
-    exception_ = exception->value_;
-    this->Escape(*exception);
+    //直接设到quickjs上，回调返回后trampoline只需检查pending_exception_
+    JS_Throw(current_context_->context_, JS_DupValueRT(runtime_, exception->value_));
+    handleException();
     return Local<Value>(exception);
 }
 
@@ -214,37 +579,330 @@ void Isolate::SetPromiseRejectCallback(PromiseRejectCallback cb) {
     }, (void*)cb);
 }
 
+void Isolate::PerformMicrotaskCheckpoint() {
+    //微任务里再触发checkpoint时直接返回，由外层继续执行
+    if (running_microtasks_) {
+        return;
+    }
+    running_microtasks_ = true;
+    size_t count = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (JS_IsJobPending(runtime_)) {
+        if (microtasks_max_count_ > 0 && count >= microtasks_max_count_) {
+            break;
+        }
+        if (microtasks_max_milliseconds_ > 0 && count > 0 &&
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() >= microtasks_max_milliseconds_) {
+            break;
+        }
+        JSContext *ctx = nullptr;
+        if (JS_ExecutePendingJob(runtime_, &ctx) < 0) {
+            //微任务的异常不抛给调用者，否则会残留在quickjs上
+            PrintUncaughtException(ctx, JS_GetException(ctx));
+        }
+        count++;
+    }
+    running_microtasks_ = false;
+}
+
+bool Isolate::HasPendingMicrotasks() {
+    return JS_IsJobPending(runtime_);
+}
+
+static JSValue FunctionMicrotask(JSContext *ctx, int argc, JSValueConst *argv) {
+    return JS_Call(ctx, argv[0], JS_Undefined(), 0, nullptr);
+}
+
+//回调和参数都用JS_TAG_EXTERNAL存，不需要引用计数
+static JSValue CallbackMicrotask(JSContext *ctx, int argc, JSValueConst *argv) {
+    MicrotaskCallback callback = (MicrotaskCallback)JS_VALUE_GET_PTR(argv[0]);
+    callback(JS_VALUE_GET_PTR(argv[1]));
+    return JS_Undefined();
+}
+
+void Isolate::EnqueueMicrotask(Local<Function> microtask) {
+    if (JS_EnqueueJob(current_context_->context_, FunctionMicrotask, 1, &microtask->value_) < 0) {
+        handleException();
+    }
+}
+
+void Isolate::EnqueueMicrotask(MicrotaskCallback callback, void* data) {
+    JSValue args[2];
+    JS_INITPTR(args[0], JS_TAG_EXTERNAL, (void*)callback);
+    JS_INITPTR(args[1], JS_TAG_EXTERNAL, data);
+    if (JS_EnqueueJob(current_context_->context_, CallbackMicrotask, 2, args) < 0) {
+        handleException();
+    }
+}
+
+MicrotasksScope::MicrotasksScope(Isolate* isolate, Type type) : isolate_(isolate), run_(type == kRunMicrotasks) {
+    if (run_) {
+        isolate_->microtasks_depth_++;
+    }
+}
+
+MicrotasksScope::~MicrotasksScope() {
+    if (run_ && --isolate_->microtasks_depth_ == 0 && isolate_->microtasks_policy_ == MicrotasksPolicy::kScoped) {
+        isolate_->PerformMicrotaskCheckpoint();
+    }
+}
+
+void MicrotasksScope::PerformCheckpoint(Isolate* isolate) {
+    if (isolate->microtasks_depth_ == 0) {
+        isolate->PerformMicrotaskCheckpoint();
+    }
+}
+
+int MicrotasksScope::GetCurrentDepth(Isolate* isolate) {
+    return isolate->microtasks_depth_;
+}
+
+bool MicrotasksScope::IsRunningMicrotasks(Isolate* isolate) {
+    return isolate->running_microtasks_;
+}
+
 Local<Value> Exception::Error(Local<String> message) {
-    Isolate *isolate = Isolate::current_;
-    Value* val = isolate->Alloc<Value>();
+    Isolate *isolate = Isolate::GetCurrent();
     JSContext* ctx = isolate->current_context_->context_;
-    val->value_ = JS_NewError(ctx);
-    JS_DefinePropertyValue(ctx, val->value_, JS_ATOM_message, JS_NewString(ctx, *String::Utf8Value(isolate, message)),
-                           JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE);
+    JSValue error = JS_NewError(ctx);
+    if (JS_IsException(error)) {
+        isolate->handleException();
+        return Local<Value>();
+    }
+    //JS_DefinePropertyValue失败时也会释放传入的值
+    JSValue message_val = JS_NewString(ctx, *String::Utf8Value(isolate, message));
+    if (JS_IsException(message_val) ||
+        JS_DefinePropertyValue(ctx, error, JS_ATOM_message, message_val, JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE) < 0) {
+        JS_FreeValue(ctx, error);
+        isolate->handleException();
+        return Local<Value>();
+    }
+    Value* val = isolate->Alloc<Value>();
+    val->value_ = error;
     return Local<Value>(val);
 }
 
 Local<Message> v8::Exception::CreateMessage(Isolate* isolate_, Local<Value> exception) {
-    JSValueConst catched_ = exception->value_;
-    JSValue fileNameVal = JS_GetProperty(isolate_->current_context_->context_, catched_, JS_ATOM_fileName);
-    JSValue lineNumVal = JS_GetProperty(isolate_->current_context_->context_, catched_, JS_ATOM_lineNumber);
-    
-    Local<v8::Message> message(new v8::Message());
-    
-    if (JS_IsUndefined(fileNameVal)) {
-        message->resource_name_ = "<unknow>";
-        message->line_number_ = - 1;
-    } else {
-        const char* fileName = JS_ToCString(isolate_->current_context_->context_, fileNameVal);
-        message->resource_name_ = fileName;
-        JS_FreeCString(isolate_->current_context_->context_, fileName);
-        JS_ToInt32(isolate_->current_context_->context_, &message->line_number_, lineNumVal);
+    return Local<v8::Message>(new v8::Message(isolate_, exception->value_));
+}
+
+//Isolate::messages_等登记表里删除，一般是后创建的先释放，所以从后往前找
+template <typename T>
+static void Unregister(std::vector<T*>& registry, T* item) {
+    auto it = std::find(registry.rbegin(), registry.rend(), item);
+    registry.erase(std::next(it).base());
+}
+
+StackFrame::StackFrame(Isolate* isolate, JSBacktrace* backtrace, int index) {
+    isolate_ = isolate;
+    backtrace_ = JS_DupBacktrace(backtrace);
+    index_ = index;
+    isolate->stack_frames_.push_back(this);
+}
+
+StackFrame::~StackFrame() {
+    Detach();
+}
+
+void StackFrame::Detach() {
+    if (!isolate_) return;
+    JS_FreeBacktrace(isolate_->runtime_, backtrace_);
+    backtrace_ = nullptr;
+    Unregister(isolate_->stack_frames_, this);
+    isolate_ = nullptr;
+}
+
+//只用到runtime，不要求在Context里；Detach后返回-1或者空
+int StackFrame::GetLineNumber() const {
+    if (!isolate_) return -1;
+    return JS_GetBacktraceFrameLineNumber(isolate_->runtime_, backtrace_, index_);
+}
+
+Local<String> StackFrame::GetScriptName() const {
+    if (!isolate_) return Local<String>();
+    JSValue name = JS_GetBacktraceFrameScriptName(isolate_->runtime_, backtrace_, index_);
+    if (JS_IsUndefined(name)) {
+        return Local<String>();
+    }
+    String *str = isolate_->Alloc<String>();
+    str->value_ = name;
+    return Local<String>(str);
+}
+
+Local<String> StackFrame::GetFunctionName() const {
+    if (!isolate_) return Local<String>();
+    JSValue name = JS_GetBacktraceFrameFunctionName(isolate_->runtime_, backtrace_, index_);
+    if (JS_IsUndefined(name)) {
+        return Local<String>();
+    }
+    String *str = isolate_->Alloc<String>();
+    str->value_ = name;
+    return Local<String>(str);
+}
+
+bool StackFrame::IsUserJavaScript() const {
+    return isolate_ && !JS_IsBacktraceFrameNative(backtrace_, index_);
+}
+
+StackTrace::StackTrace(Isolate* isolate, JSBacktrace* backtrace) {
+    isolate_ = isolate;
+    backtrace_ = backtrace;
+    isolate->stack_traces_.push_back(this);
+}
+
+StackTrace::~StackTrace() {
+    Detach();
+}
+
+void StackTrace::Detach() {
+    if (!isolate_) return;
+    JS_FreeBacktrace(isolate_->runtime_, backtrace_);
+    backtrace_ = nullptr;
+    Unregister(isolate_->stack_traces_, this);
+    isolate_ = nullptr;
+}
+
+Local<StackFrame> StackTrace::GetFrame(Isolate* isolate, uint32_t index) const {
+    if (index >= (uint32_t)GetFrameCount()) {
+        return Local<StackFrame>();
+    }
+    return Local<StackFrame>(new StackFrame(isolate, backtrace_, index));
+}
+
+//Detach后没有栈帧
+int StackTrace::GetFrameCount() const {
+    return isolate_ ? JS_GetBacktraceFrameCount(backtrace_) : 0;
+}
+
+Local<StackTrace> StackTrace::CurrentStackTrace(Isolate* isolate, int frame_limit, StackTraceOptions options) {
+    //没有进入Context时也不会有js栈帧
+    if (isolate->current_context_.IsEmpty()) {
+        return Local<StackTrace>();
     }
+    JSBacktrace* backtrace = JS_CaptureBacktrace(isolate->current_context_->context_, frame_limit);
+    if (!backtrace) {
+        return Local<StackTrace>();
+    }
+    return Local<StackTrace>(new StackTrace(isolate, backtrace));
+}
+
+Message::Message(Isolate* isolate, JSValueConst exception) {
+    isolate_ = isolate;
+    exception_ = JS_DupValueRT(isolate->runtime_, exception);
+    //只拿栈帧的引用，文件名、行号等到读取时才生成
+    backtrace_ = JS_GetErrorBacktrace(isolate->runtime_, exception);
+    resource_name_ = JS_Undefined();
+    isolate->messages_.push_back(this);
+}
+
+Message::~Message() {
+    Detach();
+}
+
+void Message::Detach() {
+    if (!isolate_) return;
+    //行号在Detach后还能读，先算好
+    Resolve();
+    JS_FreeValueRT(isolate_->runtime_, resource_name_);
+    resource_name_ = JS_Undefined();
+    JS_FreeValueRT(isolate_->runtime_, exception_);
+    exception_ = JS_Undefined();
+    if (backtrace_) {
+        JS_FreeBacktrace(isolate_->runtime_, backtrace_);
+        backtrace_ = nullptr;
+    }
+    frame_index_ = -1;
+    Unregister(isolate_->messages_, this);
+    isolate_ = nullptr;
+}
+
+void Message::Resolve() const {
+    if (resolved_ || !isolate_) return;
+    resolved_ = true;
+    //读属性需要Context，不在Context里（比如Isolate销毁时）只能看栈帧
+    JSContext* ctx = isolate_->current_context_.IsEmpty() ? nullptr : isolate_->current_context_->context_;
     
-    JS_FreeValue(isolate_->current_context_->context_, lineNumVal);
-    JS_FreeValue(isolate_->current_context_->context_, fileNameVal);
+    //语法错误等由quickjs直接给出了fileName和lineNumber
+    if (ctx && JS_IsObject(exception_)) {
+        JSValue fileNameVal = JS_GetProperty(ctx, exception_, JS_ATOM_fileName);
+        if (JS_IsException(fileNameVal)) {
+            //getter抛出的异常不能留给后面的调用
+            JS_FreeValue(ctx, JS_GetException(ctx));
+        } else if (!JS_IsUndefined(fileNameVal)) {
+            JSValue lineNumVal = JS_GetProperty(ctx, exception_, JS_ATOM_lineNumber);
+            resource_name_ = JS_ToString(ctx, fileNameVal);
+            if (JS_IsException(lineNumVal) || JS_IsException(resource_name_) ||
+                JS_ToInt32(ctx, &line_number_, lineNumVal) < 0) {
+                JS_FreeValue(ctx, JS_GetException(ctx));
+                if (JS_IsException(resource_name_)) {
+                    resource_name_ = JS_Undefined();
+                }
+            }
+            JS_FreeValue(ctx, lineNumVal);
+            JS_FreeValue(ctx, fileNameVal);
+            return;
+        }
+    }
     
-    return message;
+    //否则取抛出点最近的js栈帧
+    JSRuntime* rt = isolate_->runtime_;
+    if (backtrace_) {
+        int count = JS_GetBacktraceFrameCount(backtrace_);
+        for (int i = 0; i < count; i++) {
+            JSValue name = JS_GetBacktraceFrameScriptName(rt, backtrace_, i);
+            if (!JS_IsUndefined(name)) {
+                resource_name_ = name;
+                line_number_ = JS_GetBacktraceFrameLineNumber(rt, backtrace_, i);
+                frame_index_ = i;
+                return;
+            }
+        }
+    }
+    resource_name_ = ctx ? JS_NewString(ctx, "<unknow>") : JS_Undefined();
+    line_number_ = -1;
+}
+
+//Detach后只剩行号，资源名返回空
+Local<Value> Message::GetScriptResourceName() const {
+    Resolve();
+    if (!isolate_) {
+        return Local<Value>();
+    }
+    Value *val = isolate_->Alloc<Value>();
+    val->value_ = JS_DupValueRT(isolate_->runtime_, resource_name_);
+    return Local<Value>(val);
+}
+
+Maybe<int> Message::GetLineNumber(Local<Context> context) const {
+    Resolve();
+    return Maybe<int>(line_number_);
+}
+
+MaybeLocal<String> Message::GetSourceLine(Local<Context> context) const {
+    Resolve();
+    if (!isolate_) {
+        return MaybeLocal<String>();
+    }
+    if (frame_index_ >= 0) {
+        JSValue line = JS_GetBacktraceFrameSourceLine(context->context_, backtrace_, frame_index_);
+        if (JS_IsException(line)) {
+            isolate_->handleException();
+            return MaybeLocal<String>();
+        }
+        if (!JS_IsUndefined(line)) {
+            String *str = isolate_->Alloc<String>();
+            str->value_ = line;
+            return MaybeLocal<String>(Local<String>(str));
+        }
+    }
+    return String::Empty(context->GetIsolate());
+}
+
+Local<StackTrace> Message::GetStackTrace() const {
+    if (!backtrace_) {
+        return Local<v8::StackTrace>();
+    }
+    return Local<v8::StackTrace>(new v8::StackTrace(isolate_, JS_DupBacktrace(backtrace_)));
 }
 
 void HandleScope::Escape_(JSValue* val) {
@@ -255,15 +913,7 @@ void HandleScope::Escape_(JSValue* val) {
 
 void HandleScope::Exit() {
     if(prev_pos_ < isolate_->value_alloc_pos_) {
-        //std::cout << "---------------- start HandleScope::Exit -------------------" << std::endl;
-        //std::cout << prev_pos_ << "," << isolate_->value_alloc_pos_ << std::endl;
-        isolate_->ForeachAllocValue(prev_pos_, isolate_->value_alloc_pos_, [this](JSValue* val, int idx){
-            if (JS_VALUE_HAS_REF_COUNT(*val)) {
-                JS_FreeValueRT(isolate_->runtime_, *val);
-            }
-        });
-        isolate_->value_alloc_pos_ = prev_pos_;
-        //std::cout << "---------------- end HandleScope::Exit -------------------" << std::endl;
+        isolate_->FreeHandles(prev_pos_);
     }
     
     if (JS_VALUE_HAS_REF_COUNT(scope_value_)) {
@@ -272,7 +922,7 @@ void HandleScope::Exit() {
 }
 
 bool Value::IsFunction() const {
-    return JS_IsFunction(Isolate::current_->GetCurrentContext()->context_, value_);
+    return JS_IsFunction(Isolate::GetCurrent()->GetCurrentContext()->context_, value_);
 }
 
 bool Value::IsDate() const {
@@ -283,16 +933,79 @@ bool Value::IsArrayBuffer() const {
     return JS_IsArrayBuffer(value_);
 }
 
+bool Value::IsSharedArrayBuffer() const {
+    return JS_IsSharedArrayBuffer(value_);
+}
+
 bool Value::IsArrayBufferView() const {
     return JS_IsArrayBufferView(value_);
 }
 
+bool Value::IsTypedArray() const {
+    int kind = JS_GetArrayBufferViewKind(value_);
+    return kind >= 0 && kind != JS_TYPED_ARRAY_DATAVIEW;
+}
+
+bool Value::IsUint8Array() const {
+    return JS_GetArrayBufferViewKind(value_) == JS_TYPED_ARRAY_UINT8;
+}
+
+bool Value::IsUint8ClampedArray() const {
+    return JS_GetArrayBufferViewKind(value_) == JS_TYPED_ARRAY_UINT8C;
+}
+
+bool Value::IsInt8Array() const {
+    return JS_GetArrayBufferViewKind(value_) == JS_TYPED_ARRAY_INT8;
+}
+
+bool Value::IsUint16Array() const {
+    return JS_GetArrayBufferViewKind(value_) == JS_TYPED_ARRAY_UINT16;
+}
+
+bool Value::IsInt16Array() const {
+    return JS_GetArrayBufferViewKind(value_) == JS_TYPED_ARRAY_INT16;
+}
+
+bool Value::IsUint32Array() const {
+    return JS_GetArrayBufferViewKind(value_) == JS_TYPED_ARRAY_UINT32;
+}
+
+bool Value::IsInt32Array() const {
+    return JS_GetArrayBufferViewKind(value_) == JS_TYPED_ARRAY_INT32;
+}
+
+bool Value::IsFloat32Array() const {
+    return JS_GetArrayBufferViewKind(value_) == JS_TYPED_ARRAY_FLOAT32;
+}
+
+bool Value::IsFloat64Array() const {
+    return JS_GetArrayBufferViewKind(value_) == JS_TYPED_ARRAY_FLOAT64;
+}
+
+bool Value::IsBigInt64Array() const {
+    return JS_GetArrayBufferViewKind(value_) == JS_TYPED_ARRAY_BIGINT64;
+}
+
+bool Value::IsBigUint64Array() const {
+    return JS_GetArrayBufferViewKind(value_) == JS_TYPED_ARRAY_BIGUINT64;
+}
+
+bool Value::IsDataView() const {
+    return JS_GetArrayBufferViewKind(value_) == JS_TYPED_ARRAY_DATAVIEW;
+}
+
 bool Value::IsObject() const {
     return JS_IsObject(value_);
 }
 
+//revoke过的Proxy会抛异常
 bool Value::IsArray() const {
-    return JS_IsArray(Isolate::current_->GetCurrentContext()->context_, value_);
+    int ret = JS_IsArray(Isolate::GetCurrent()->GetCurrentContext()->context_, value_);
+    if (ret < 0) {
+        Isolate::GetCurrent()->handleException();
+        return false;
+    }
+    return ret != 0;
 }
 
 bool Value::IsBigInt() const {
@@ -334,6 +1047,7 @@ MaybeLocal<Number> Value::ToNumber(Local<Context> context) const {
     else {
         double d;
         if (JS_ToFloat64(context->context_, &d, value_)) {
+            context->GetIsolate()->handleException();
             return MaybeLocal<Number>();
         }
         else {
@@ -367,9 +1081,14 @@ MaybeLocal<String> Value::ToString(Local<Context> context) const {
     if (JS_IsString(value_)) {
         return MaybeLocal<String>(Local<String>(static_cast<String*>(const_cast<Value*>(this))));
     } else {
+        JSValue value = JS_ToString(context->context_, value_);
+        if (JS_IsException(value)) {
+            context->GetIsolate()->handleException();
+            return MaybeLocal<String>();
+        }
         //由HandleScope跟踪回收
         String * str = context->GetIsolate()->Alloc<String>();
-        str->value_ = JS_ToString(context->context_, value_);
+        str->value_ = value;
         return MaybeLocal<String>(Local<String>(str));
     }
     
@@ -387,14 +1106,44 @@ V8_WARN_UNUSED_RESULT Maybe<double> Value::NumberValue(Local<Context> context) c
     return Maybe<double>(Number::Cast(const_cast<Value*>(this))->Value());
 }
 
+//NewFromUtf8/NewFromOneByte/NewFromTwoByte共用：失败（OOM、超长）时交给TryCatch并返回空
+static V8_INLINE MaybeLocal<String> NewStringValue(Isolate* isolate, JSValue value, NewStringType type) {
+    if (type == NewStringType::kInternalized) {
+        value = JS_InternString(isolate->current_context_->context_, value);
+    }
+    if (JS_IsException(value)) {
+        isolate->handleException();
+        return MaybeLocal<String>();
+    }
+    String *str = isolate->Alloc<String>();
+    str->value_ = value;
+    return Local<String>(str);
+}
+
 MaybeLocal<String> String::NewFromUtf8(
     Isolate* isolate, const char* data,
     NewStringType type, int length) {
-    String *str = isolate->Alloc<String>();
-    //printf("NewFromUtf8:%p\n", str);
-    size_t len = length > 0 ? length : strlen(data);
-    str->value_ = JS_NewStringLen(isolate->current_context_->context_, data, len);
-    return Local<String>(str);
+    size_t len = length >= 0 ? length : strlen(data);
+    return NewStringValue(isolate, JS_NewStringLen(isolate->current_context_->context_, data, len), type);
+}
+
+MaybeLocal<String> String::NewFromOneByte(
+    Isolate* isolate, const uint8_t* data,
+    NewStringType type, int length) {
+    size_t len = length >= 0 ? length : strlen(reinterpret_cast<const char*>(data));
+    return NewStringValue(isolate, JS_NewOneByteString(isolate->current_context_->context_, data, len), type);
+}
+
+MaybeLocal<String> String::NewFromTwoByte(
+    Isolate* isolate, const uint16_t* data,
+    NewStringType type, int length) {
+    size_t len = 0;
+    if (length >= 0) {
+        len = length;
+    } else {
+        while (data[len]) ++len;
+    }
+    return NewStringValue(isolate, JS_NewTwoByteString(isolate->current_context_->context_, data, len), type);
 }
 
 Local<String> String::Empty(Isolate* isolate) {
@@ -404,33 +1153,107 @@ Local<String> String::Empty(Isolate* isolate) {
     return Local<String>(reinterpret_cast<String*>(&isolate->literal_values_[kEmptyStringIndex]));
 }
 
+int String::Length() const {
+    return (int)JS_GetStringLength(value_);
+}
+
+bool String::IsOneByte() const {
+    return JS_IsOneByteString(value_);
+}
+
+const uint8_t* String::GetOneByteView(int* length) const {
+    const uint8_t* data = JS_GetStringOneByteData(value_);
+    if (data && length) {
+        *length = Length();
+    }
+    return data;
+}
+
+//V8的Write/WriteOneByte对start、length的处理
+static V8_INLINE int WriteRange(int str_length, int start, int length) {
+    if (start < 0 || start > str_length) {
+        return 0;
+    }
+    int end = (length < 0 || length > str_length - start) ? str_length : start + length;
+    return end - start;
+}
+
+int String::Write(Isolate* isolate, uint16_t* buffer, int start, int length,
+                  int options) const {
+    int count = WriteRange(Length(), start, length);
+    JS_CopyStringUTF16(value_, buffer, start, count);
+    if (!(options & NO_NULL_TERMINATION) && (length < 0 || count < length)) {
+        buffer[count] = 0;
+    }
+    return count;
+}
+
+int String::WriteOneByte(Isolate* isolate, uint8_t* buffer, int start,
+                         int length, int options) const {
+    int count = WriteRange(Length(), start, length);
+    JS_CopyStringOneByte(value_, buffer, start, count);
+    if (!(options & NO_NULL_TERMINATION) && (length < 0 || count < length)) {
+        buffer[count] = 0;
+    }
+    return count;
+}
+
 int String::Utf8Length(Isolate* isolate) const {
-    size_t len;
-    const char* p = JS_ToCStringLen(isolate->current_context_->context_, &len, value_);
-    JS_FreeCString(isolate->current_context_->context_, p);
-    return (int)len;
+    return (int)JS_GetStringUtf8Length(value_);
 }
 
 int String::WriteUtf8(Isolate* isolate, char* buffer) const {
-    size_t len;
-    const char* p = JS_ToCStringLen(isolate->current_context_->context_, &len, value_);
-    
-    memcpy(buffer, p, len);
+    return (int)JS_WriteStringUtf8(value_, buffer, SIZE_MAX, nullptr, false);
+}
+
+int String::WriteUtf8(Isolate* isolate, char* buffer, int capacity,
+                      int* nchars_ref, int options) const {
+    size_t max_bytes = capacity < 0 ? SIZE_MAX : (size_t)capacity;
+    int nchars;
+    size_t written = JS_WriteStringUtf8(value_, buffer, max_bytes, &nchars, (options & REPLACE_INVALID_UTF8) != 0);
+    //和V8一样，只有整个字符串都写进去了才补'\0'
+    if (!(options & NO_NULL_TERMINATION) && written < max_bytes && (uint32_t)nchars == JS_GetStringLength(value_)) {
+        buffer[written++] = '\0';
+    }
+    if (nchars_ref) {
+        *nchars_ref = nchars;
+    }
+    return (int)written;
+}
+
+static JSValue CompileScript(Isolate* isolate, JSContext* ctx, Local<String> source, Local<Value> resource_name) {
+    String::Utf8Value source_utf8(isolate, source);
+    const int eval_flags = JS_EVAL_TYPE_GLOBAL | JS_EVAL_FLAG_COMPILE_ONLY;
+    if (resource_name.IsEmpty()) {
+        return JS_Eval(ctx, *source_utf8, source_utf8.length(), "eval", eval_flags);
+    }
+    String::Utf8Value filename(isolate, resource_name);
+    return JS_Eval(ctx, *source_utf8, source_utf8.length(), *filename, eval_flags);
+}
+
+Local<Script> Script::New_(Context* context, JSValue bytecode, uint32_t source_length) {
+    UnboundScript* unbound_script = new UnboundScript();
+    unbound_script->function_bytecode_ = bytecode;
+    unbound_script->context_ = context;
+    unbound_script->runtime_ = JS_GetRuntime(context->context_);
+    unbound_script->source_length_ = source_length;
+    context->unbound_scripts_.push_back(unbound_script);
     
-    JS_FreeCString(isolate->current_context_->context_, p);
-    return (int)len;
+    Script* script = new Script();
+    script->unbound_script_ = Local<UnboundScript>(unbound_script);
+    return Local<Script>(script);
 }
 
-//！！如果一个Local<String>用到这个接口了，就不能再传入JS
 MaybeLocal<Script> Script::Compile(
     Local<Context> context, Local<String> source,
     ScriptOrigin* origin) {
-    Script* script = new Script();
-    script->source_ = source;
-    if (origin) {
-        script->resource_name_ = MaybeLocal<String>(Local<String>::Cast(origin->resource_name_));
+    auto isolate = context->GetIsolate();
+    JSValue bytecode = CompileScript(isolate, context->context_, source, origin ? origin->resource_name_ : Local<Value>());
+    if (JS_IsException(bytecode)) {
+        isolate->handleException();
+        return MaybeLocal<Script>();
     }
-    return MaybeLocal<Script>(Local<Script>(script));
+    return MaybeLocal<Script>(New_(*context, bytecode, JS_GetStringLength(source->value_)));
 }
 
 static V8_INLINE MaybeLocal<Value> ProcessResult(Isolate *isolate, JSValue ret) {
@@ -446,21 +1269,295 @@ static V8_INLINE MaybeLocal<Value> ProcessResult(Isolate *isolate, JSValue ret)
     }
 }
 
-MaybeLocal<Value> Script::Run(Local<Context> context) {
-    auto isolate = context->GetIsolate();
+MaybeLocal<Value> Script::Run(Local<Context> context) {
+    //字节码在编译时的Context里执行，换了Context（或者原Context已经析构）要先重新绑定
+    if (V8_UNLIKELY(unbound_script_->context_ != *context) && !unbound_script_->BindTo(*context)) {
+        context->GetIsolate()->handleException();
+        return MaybeLocal<Value>();
+    }
+    
+    //JS_EvalFunction会释放传入的字节码，而同一个Script可能被多次Run
+    auto ret = JS_EvalFunction(context->context_, JS_DupValue(context->context_, unbound_script_->function_bytecode_));
+
+    return ProcessResult(context->GetIsolate(), ret);
+}
+
+bool UnboundScript::BindTo(Context* context) {
+    if (context_) {
+        size_t size;
+        uint8_t* buf = JS_WriteObject(context_->context_, &size, function_bytecode_, JS_WRITE_OBJ_BYTECODE);
+        if (!buf) {
+            return false;
+        }
+        detached_bytecode_.assign(buf, buf + size);
+        js_free_rt(runtime_, buf);
+        
+        JS_FreeValueRT(runtime_, function_bytecode_);
+        function_bytecode_ = JS_Undefined();
+        auto& unbound_scripts = context_->unbound_scripts_;
+        unbound_scripts.erase(std::remove(unbound_scripts.begin(), unbound_scripts.end(), this), unbound_scripts.end());
+        context_ = nullptr;
+    }
+    
+    if (!context) {
+        return true;
+    }
+    
+    JSValue bytecode = JS_ReadObject(context->context_, detached_bytecode_.data(), detached_bytecode_.size(), JS_READ_OBJ_BYTECODE);
+    if (JS_IsException(bytecode)) {
+        return false;
+    }
+    function_bytecode_ = bytecode;
+    context_ = context;
+    context->unbound_scripts_.push_back(this);
+    std::vector<uint8_t>().swap(detached_bytecode_);
+    return true;
+}
+
+UnboundScript::~UnboundScript() {
+    if (context_) {
+        auto& unbound_scripts = context_->unbound_scripts_;
+        unbound_scripts.erase(std::remove(unbound_scripts.begin(), unbound_scripts.end(), this), unbound_scripts.end());
+    }
+    JS_FreeValueRT(runtime_, function_bytecode_);
+}
+
+//code cache格式：头部 + JS_WriteObject输出的字节码。和V8一样只用源码长度来校验cache和源码是否匹配，
+//字节码版本不对由JS_ReadObject检查
+struct CodeCacheHeader {
+    uint32_t magic_;
+    uint32_t source_length_;
+};
+
+static const uint32_t kCodeCacheMagic = 0x43534a51; // "QJSC"
+
+static JSValue ReadCodeCache(JSContext* ctx, Local<String> source, const ScriptCompiler::CachedData* cached_data) {
+    CodeCacheHeader header;
+    if (cached_data->data == nullptr || cached_data->length <= (int)sizeof(header)) {
+        return JS_Undefined();
+    }
+    memcpy(&header, cached_data->data, sizeof(header));
+    if (header.magic_ != kCodeCacheMagic || header.source_length_ != JS_GetStringLength(source->value_)) {
+        return JS_Undefined();
+    }
+    
+    JSValue bytecode = JS_ReadObject(ctx, cached_data->data + sizeof(header), cached_data->length - sizeof(header), JS_READ_OBJ_BYTECODE);
+    if (JS_IsException(bytecode)) {
+        JS_FreeValue(ctx, JS_GetException(ctx));
+        return JS_Undefined();
+    }
+    if (JS_VALUE_GET_TAG(bytecode) != JS_TAG_FUNCTION_BYTECODE) {
+        JS_FreeValue(ctx, bytecode);
+        return JS_Undefined();
+    }
+    return bytecode;
+}
+
+MaybeLocal<Script> ScriptCompiler::Compile(
+    Local<Context> context, Source* source,
+    CompileOptions options) {
+    if (options == kConsumeCodeCache && source->cached_data_) {
+        JSValue bytecode = ReadCodeCache(context->context_, source->source_string_, source->cached_data_);
+        if (!JS_IsUndefined(bytecode)) {
+            return MaybeLocal<Script>(Script::New_(*context, bytecode, JS_GetStringLength(source->source_string_->value_)));
+        }
+        source->cached_data_->rejected = true;
+    }
+    
+    ScriptOrigin origin(source->resource_name_);
+    return Script::Compile(context, source->source_string_, source->resource_name_.IsEmpty() ? nullptr : &origin);
+}
+
+ScriptCompiler::CachedData* ScriptCompiler::CreateCodeCache(Local<UnboundScript> unbound_script) {
+    JSContext* ctx = Isolate::GetCurrent()->current_context_->context_;
+    
+    size_t size;
+    uint8_t* buf;
+    if (unbound_script->context_) {
+        buf = JS_WriteObject(ctx, &size, unbound_script->function_bytecode_, JS_WRITE_OBJ_BYTECODE);
+        if (!buf) {
+            JS_FreeValue(ctx, JS_GetException(ctx));
+            return nullptr;
+        }
+    } else {
+        //已经是序列化的格式
+        buf = unbound_script->detached_bytecode_.data();
+        size = unbound_script->detached_bytecode_.size();
+    }
+    
+    CodeCacheHeader header;
+    header.magic_ = kCodeCacheMagic;
+    header.source_length_ = unbound_script->source_length_;
+    
+    uint8_t* data = new uint8_t[sizeof(header) + size];
+    memcpy(data, &header, sizeof(header));
+    memcpy(data + sizeof(header), buf, size);
+    if (unbound_script->context_) {
+        js_free(ctx, buf);
+    }
+    
+    return new CachedData(data, (int)(sizeof(header) + size), CachedData::BufferOwned);
+}
+
+MaybeLocal<Module> ScriptCompiler::CompileModule(
+    Isolate* isolate, Source* source,
+    CompileOptions options) {
+    Local<Context> context = isolate->GetCurrentContext();
+    JSContext* ctx = context->context_;
+    
+    String::Utf8Value source_utf8(isolate, source->source_string_);
+    std::string name = "module";
+    if (!source->resource_name_.IsEmpty()) {
+        name = *String::Utf8Value(isolate, source->resource_name_);
+    }
+    
+    JSValue module_val = JS_Eval(ctx, *source_utf8, source_utf8.length(), name.c_str(), JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY | JS_EVAL_FLAG_NO_RESOLVE);
+    if (JS_IsException(module_val)) {
+        isolate->handleException();
+        return MaybeLocal<Module>();
+    }
+    
+    //JS_Eval返回的引用由Module持有
+    Module* module = new Module();
+    module->module_ = reinterpret_cast<JSModuleDef*>(JS_VALUE_GET_PTR(module_val));
+    module->context_ = ctx;
+    Local<Module> result(module);
+    context->module_names_.emplace(name, context->modules_.size());
+    context->modules_.push_back(result);
+    return MaybeLocal<Module>(result);
+}
+
+//quickjs在解析import（包括动态import）时回调，通过Context里的缓存或者InstantiateModule传入的回调找到目标模块，
+//返回它的模块名，quickjs再按模块名在已加载模块里找到它
+static char* ModuleNormalize(JSContext* ctx, const char* base_name, const char* specifier, void* opaque) {
+    Isolate* isolate = reinterpret_cast<Isolate*>(opaque);
+    Context* context = reinterpret_cast<Context*>(JS_GetContextOpaque(ctx));
+    
+    std::string key(base_name);
+    key.push_back('\0');
+    key.append(specifier);
+    auto iter = context->resolved_modules_.find(key);
+    if (iter != context->resolved_modules_.end()) {
+        return js_strdup(ctx, iter->second.c_str());
+    }
+    
+    if (!context->resolve_module_callback_) {
+        JS_ThrowReferenceError(ctx, "could not resolve module '%s'", specifier);
+        return nullptr;
+    }
+    
+    HandleScope handle_scope(isolate);
+    Local<Module> referrer;
+    auto referrer_iter = context->module_names_.find(base_name);
+    if (referrer_iter != context->module_names_.end()) {
+        referrer = context->modules_[referrer_iter->second];
+    }
+    
+    Local<Module> module;
+    bool resolved;
+    JSValue ex = JS_Undefined();
+    {
+        //这里可能不在js栈帧里，回调抛出的异常先截下来，再交给quickjs
+        TryCatch try_catch(isolate);
+        resolved = context->resolve_module_callback_(isolate->GetCurrentContext(),
+            String::NewFromUtf8(isolate, specifier).ToLocalChecked(), referrer).ToLocal(&module);
+        if (try_catch.HasCaught()) {
+            ex = JS_DupValue(ctx, try_catch.catched_);
+        }
+    }
+    
+    if (!JS_IsUndefined(ex)) {
+        JS_Throw(ctx, ex);
+        return nullptr;
+    }
+    if (!resolved || !module->module_ || module->context_ != ctx) {
+        JS_ThrowReferenceError(ctx, "could not resolve module '%s'", specifier);
+        return nullptr;
+    }
+    
+    JSAtom name_atom = JS_GetModuleName(ctx, module->module_);
+    const char* name = JS_AtomToCString(ctx, name_atom);
+    JS_FreeAtom(ctx, name_atom);
+    if (!name) {
+        return nullptr;
+    }
+    context->resolved_modules_.emplace(std::move(key), name);
+    char* ret = js_strdup(ctx, name);
+    JS_FreeCString(ctx, name);
+    return ret;
+}
+
+Module::Status Module::GetStatus() const {
+    if (!module_) {
+        return kErrored;
+    }
+    switch (JS_GetModuleStatus(module_)) {
+        case 1:
+            return kInstantiated;
+        case 2:
+            return kEvaluated;
+        case 3:
+            return kErrored;
+        default:
+            return kUninstantiated;
+    }
+}
+
+Local<Value> Module::GetException() const {
+    Value* val = Isolate::GetCurrent()->Alloc<Value>();
+    val->value_ = module_ ? JS_GetModuleException(context_, module_) : JS_Undefined();
+    return Local<Value>(val);
+}
+
+int Module::GetModuleRequestsLength() const {
+    return module_ ? JS_GetModuleRequestsLength(module_) : 0;
+}
+
+//module_已释放或者下标越界时返回空
+Local<String> Module::GetModuleRequest(int i) const {
+    if (!module_ || i < 0 || i >= JS_GetModuleRequestsLength(module_)) {
+        return Local<String>();
+    }
+    String* str = Isolate::GetCurrent()->Alloc<String>();
+    str->value_ = JS_AtomToString(context_, JS_GetModuleRequest(module_, i));
+    return Local<String>(str);
+}
+
+int Module::GetIdentityHash() const {
+    return (int)(reinterpret_cast<uintptr_t>(module_) >> 3);
+}
 
-    String::Utf8Value source(isolate, source_);
-    const char *filename = resource_name_.IsEmpty() ? "eval" : *String::Utf8Value(isolate, resource_name_.ToLocalChecked());
-    auto ret = JS_Eval(context->context_, *source, source.length(), filename, JS_EVAL_TYPE_GLOBAL);
+//Module所在的Context析构后module_为空，在传入的context上抛异常
+static void ThrowModuleReleased(Local<Context> context) {
+    JS_ThrowReferenceError(context->context_, "module has been released with its context");
+    context->GetIsolate()->handleException();
+}
 
-    return ProcessResult(isolate, ret);
+Maybe<bool> Module::InstantiateModule(Local<Context> context, ResolveCallback callback) {
+    if (!module_) {
+        ThrowModuleReleased(context);
+        return Maybe<bool>();
+    }
+    context->resolve_module_callback_ = callback;
+    if (JS_InstantiateModule(context_, module_) < 0) {
+        context->GetIsolate()->handleException();
+        return Maybe<bool>();
+    }
+    return Maybe<bool>(true);
+}
+
+MaybeLocal<Value> Module::Evaluate(Local<Context> context) {
+    if (!module_) {
+        ThrowModuleReleased(context);
+        return MaybeLocal<Value>();
+    }
+    return ProcessResult(context->GetIsolate(), JS_EvaluateModule(context_, module_));
 }
 
-Script::~Script() {
-    //JS_FreeValue(context_->context_, source_->value_);
-    //if (!resource_name_.IsEmpty()) {
-    //    JS_FreeValue(context_->context_, resource_name_.ToLocalChecked()->value_);
-    //}
+Local<Value> Module::GetModuleNamespace() {
+    Value* val = Isolate::GetCurrent()->Alloc<Value>();
+    val->value_ = module_ ? JS_GET_MODULE_NS(context_, module_) : JS_Undefined();
+    return Local<Value>(val);
 }
 
 Local<External> External::New(Isolate* isolate, void* value) {
@@ -475,7 +1572,7 @@ void* External::Value() const {
 
 double Number::Value() const {
     double ret;
-    JS_ToFloat64(Isolate::current_->current_context_->context_, &ret, value_);
+    JS_ToFloat64(Isolate::GetCurrent()->current_context_->context_, &ret, value_);
     return ret;
 }
 
@@ -497,16 +1594,23 @@ Local<Integer> Integer::NewFromUnsigned(Isolate* isolate, uint32_t value) {
     return Local<Integer>(ret);
 }
 
-Local<BigInt> BigInt::New(Isolate* isolate, int64_t value) {
+//BigInt要分配内存，OOM时返回空
+static Local<BigInt> NewBigIntValue(Isolate* isolate, JSValue value) {
+    if (JS_IsException(value)) {
+        isolate->handleException();
+        return Local<BigInt>();
+    }
     BigInt* ret = isolate->Alloc<BigInt>();
-    ret->value_ = JS_NewBigInt64(isolate->current_context_->context_, value);
+    ret->value_ = value;
     return Local<BigInt>(ret);
 }
 
+Local<BigInt> BigInt::New(Isolate* isolate, int64_t value) {
+    return NewBigIntValue(isolate, JS_NewBigInt64(isolate->current_context_->context_, value));
+}
+
 Local<BigInt> BigInt::NewFromUnsigned(Isolate* isolate, uint64_t value) {
-    BigInt* ret = isolate->Alloc<BigInt>();
-    ret->value_ = JS_NewBigUint64(isolate->current_context_->context_, value);
-    return Local<BigInt>(ret);
+    return NewBigIntValue(isolate, JS_NewBigUint64(isolate->current_context_->context_, value));
 }
 
 uint64_t BigInt::Uint64Value(bool* lossless) const {
@@ -515,7 +1619,7 @@ uint64_t BigInt::Uint64Value(bool* lossless) const {
 
 int64_t BigInt::Int64Value(bool* lossless) const {
     int64_t ret;
-    JS_ToBigInt64(Isolate::current_->current_context_->context_, &ret, value_);
+    JS_ToBigInt64(Isolate::GetCurrent()->current_context_->context_, &ret, value_);
     return ret;
 }
 
@@ -535,8 +1639,11 @@ int64_t Integer::Value() const {
     } else if (JS_VALUE_GET_TAG(value_) == JS_TAG_FLOAT64) {
         return (int64_t)JS_VALUE_GET_FLOAT64(value_);
     } else {
+        //不是数字时会调用valueOf，可能抛出异常
         int64_t i;
-        JS_ToInt64(Isolate::current_->GetCurrentContext()->context_, &i, value_);
+        if (JS_ToInt64(Isolate::GetCurrent()->GetCurrentContext()->context_, &i, value_) < 0) {
+            Isolate::GetCurrent()->handleException();
+        }
         return i;
     }
 }
@@ -548,15 +1655,42 @@ int32_t Int32::Value() const {
         return (int32_t)JS_VALUE_GET_FLOAT64(value_);
     } else {
         int32_t i;
-        JS_ToInt32(Isolate::current_->GetCurrentContext()->context_, &i, value_);
+        if (JS_ToInt32(Isolate::GetCurrent()->GetCurrentContext()->context_, &i, value_) < 0) {
+            Isolate::GetCurrent()->handleException();
+        }
         return i;
     }
 }
 
 String::Utf8Value::Utf8Value(Isolate* isolate, Local<v8::Value> obj) {
-    auto context = isolate->GetCurrentContext();
-    data_ = JS_ToCStringLen(context->context_, &len_, obj->value_);
-    context_ = context->context_;
+    JSValue value = obj->value_;
+    JSContext* ctx = isolate->current_context_->context_;
+    if (JS_IsString(value)) {
+        uint32_t length = JS_GetStringLength(value);
+        const char* ascii = JS_GetStringASCIIData(value);
+        if (ascii) {
+            //ASCII：和JS_ToCStringLen一样直接借用内部buffer并持有一个引用，析构时由JS_FreeCString释放
+            JS_DupValue(ctx, value);
+            data_ = ascii;
+            len_ = length;
+            context_ = ctx;
+            return;
+        }
+        //短字符串编码到inline_buffer_，放不下再走JS_ToCStringLen
+        int nchars;
+        len_ = JS_WriteStringUtf8(value, inline_buffer_, sizeof(inline_buffer_) - 1, &nchars, false);
+        if ((uint32_t)nchars == length) {
+            inline_buffer_[len_] = '\0';
+            data_ = inline_buffer_;
+            return;
+        }
+    }
+    //和V8一样，转换失败时为nullptr、长度0，异常交给TryCatch
+    data_ = JS_ToCStringLen(ctx, &len_, value);
+    context_ = ctx;
+    if (!data_) {
+        isolate->handleException();
+    }
 }
 
 String::Utf8Value::~Utf8Value() {
@@ -565,24 +1699,50 @@ String::Utf8Value::~Utf8Value() {
     }
 }
 
+String::Value::Value(Isolate* isolate, Local<v8::Value> obj) {
+    JSContext* ctx = isolate->GetCurrentContext()->context_;
+    JSValue str = JS_IsString(obj->value_) ? JS_DupValue(ctx, obj->value_) : JS_ToString(ctx, obj->value_);
+    if (JS_IsException(str)) {
+        JS_FreeValue(ctx, JS_GetException(ctx));
+        str_ = nullptr;
+        length_ = 0;
+        return;
+    }
+    length_ = (int)JS_GetStringLength(str);
+    str_ = new uint16_t[length_ + 1];
+    JS_CopyStringUTF16(str, str_, 0, length_);
+    str_[length_] = 0;
+    JS_FreeValue(ctx, str);
+}
+
+String::Value::~Value() {
+    delete[] str_;
+}
+
 MaybeLocal<Value> Date::New(Local<Context> context, double time) {
+    JSValue value = JS_NewDate(context->context_, time);
+    if (JS_IsException(value)) {
+        context->GetIsolate()->handleException();
+        return MaybeLocal<Value>();
+    }
     Date *date = context->GetIsolate()->Alloc<Date>();
-    date->value_ = JS_NewDate(context->context_, time);
+    date->value_ = value;
     return MaybeLocal<Value>(Local<Date>(date));
 }
     
 double Date::ValueOf() const {
-    return JS_GetDate(Isolate::current_->current_context_->context_, value_);
+    return JS_GetDate(Isolate::GetCurrent()->current_context_->context_, value_);
 }
 
 void Map::Clear() {
-    JS_MapClear(Isolate::current_->GetCurrentContext()->context_, value_);
+    JS_MapClear(Isolate::GetCurrent()->GetCurrentContext()->context_, value_);
 }
 
 MaybeLocal<Value> Map::Get(Local<Context> context,
                            Local<Value> key) {
     JSValue v = JS_MapGet(context->context_, value_, key->value_);
     if (JS_IsException(v)) {
+        context->GetIsolate()->handleException();
         return MaybeLocal<Value>();
     }
     Value *val = context->GetIsolate()->Alloc<Value>();
@@ -595,6 +1755,7 @@ MaybeLocal<Map> Map::Set(Local<Context> context,
                          Local<Value> value) {
     JSValue m = JS_MapSet(context->context_, value_, key->value_, value->value_);
     if (JS_IsException(m)) {
+        context->GetIsolate()->handleException();
         return MaybeLocal<Map>();
     }
     Map *map = context->GetIsolate()->Alloc<Map>();
@@ -606,6 +1767,7 @@ MaybeLocal<Value> Map::Delete(Local<Context> context,
                            Local<Value> key) {
     JSValue v = JS_MapDelete(context->context_, value_, key->value_);
     if (JS_IsException(v)) {
+        context->GetIsolate()->handleException();
         return MaybeLocal<Value>();
     }
     Value *val = context->GetIsolate()->Alloc<Value>();
@@ -614,62 +1776,365 @@ MaybeLocal<Value> Map::Delete(Local<Context> context,
 }
 
 Local<Map> Map::New(Isolate* isolate) {
+    JSValue value = JS_NewMap(isolate->GetCurrentContext()->context_);
+    if (JS_IsException(value)) {
+        isolate->handleException();
+        return Local<Map>();
+    }
     Map *map = isolate->Alloc<Map>();
-    map->value_ = JS_NewMap(isolate->GetCurrentContext()->context_);
+    map->value_ = value;
     return Local<Map>(map);
 }
 
-static std::vector<uint8_t> dummybuffer;
+class DefaultArrayBufferAllocator : public ArrayBuffer::Allocator {
+public:
+    void* Allocate(size_t length) override {
+        return calloc(length, 1);
+    }
+    
+    void* AllocateUninitialized(size_t length) override {
+        return malloc(length);
+    }
+    
+    void Free(void* data, size_t length) override {
+        free(data);
+    }
+};
+
+ArrayBuffer::Allocator* ArrayBuffer::Allocator::NewDefaultAllocator() {
+    return new DefaultArrayBufferAllocator();
+}
 
+//长度超出限制或者内存不足时返回空，异常交给TryCatch
 Local<ArrayBuffer> ArrayBuffer::New(Isolate* isolate, size_t byte_length) {
+    JSValue value = JS_NewArrayBufferZeroed(isolate->current_context_->context_, byte_length);
+    if (JS_IsException(value)) {
+        isolate->handleException();
+        return Local<ArrayBuffer>();
+    }
     ArrayBuffer *ab = isolate->Alloc<ArrayBuffer>();
-    if (dummybuffer.size() < byte_length) dummybuffer.resize(byte_length, 0);
-    ab->value_ = JS_NewArrayBufferCopy(isolate->current_context_->context_, dummybuffer.data(), byte_length);
+    ab->value_ = value;
     return Local<ArrayBuffer>(ab);
 }
 
+BackingStore::~BackingStore() {
+    if (deleter_) {
+        deleter_(data_, byte_length_, deleter_data_);
+    }
+}
+
+void BackingStore::EmptyDeleter(void* data, size_t length, void* deleter_data) {
+}
+
+static void BackingStoreFreeDeleter(void* data, size_t length, void* deleter_data) {
+    free(data);
+}
+
+static void BackingStoreAllocatorDeleter(void* data, size_t length, void* deleter_data) {
+    reinterpret_cast<ArrayBuffer::Allocator*>(deleter_data)->Free(data, length);
+}
+
+//我们自己通过Allocator分配的内存：0字节时实际分配了1字节，Free要传分配时的大小
+static void BackingStoreAllocatedDeleter(void* data, size_t length, void* deleter_data) {
+    reinterpret_cast<ArrayBuffer::Allocator*>(deleter_data)->Free(data, length > 0 ? length : 1);
+}
+
+//ArrayBuffer持有的那份shared_ptr，buffer被回收或者detach时释放
+static void BackingStoreHolderFree(JSRuntime* rt, void* opaque, void* ptr) {
+    delete reinterpret_cast<std::shared_ptr<BackingStore>*>(opaque);
+}
+
 Local<ArrayBuffer> ArrayBuffer::New(Isolate* isolate, void* data, size_t byte_length,
                                            ArrayBufferCreationMode mode) {
-    V8::Check(mode == ArrayBufferCreationMode::kExternalized, "only ArrayBufferCreationMode::kExternalized support!");
+    if (mode == ArrayBufferCreationMode::kInternalized) {
+        //内存交给ArrayBuffer，按V8的约定由isolate的Allocator释放
+        ArrayBuffer::Allocator* allocator = isolate->array_buffer_allocator_;
+        return New(isolate, NewBackingStore(data, byte_length,
+            allocator ? BackingStoreAllocatorDeleter : BackingStoreFreeDeleter, allocator));
+    }
+    JSValue value = JS_NewArrayBuffer(isolate->current_context_->context_, (uint8_t*)data, byte_length, nullptr, nullptr, false);
+    if (JS_IsException(value)) {
+        isolate->handleException();
+        return Local<ArrayBuffer>();
+    }
+    ArrayBuffer *ab = isolate->Alloc<ArrayBuffer>();
+    ab->value_ = value;
+    return Local<ArrayBuffer>(ab);
+}
+
+Local<ArrayBuffer> ArrayBuffer::New(Isolate* isolate, std::shared_ptr<BackingStore> backing_store) {
+    uint8_t* data = (uint8_t*)backing_store->Data();
+    size_t byte_length = backing_store->ByteLength();
+    auto holder = new std::shared_ptr<BackingStore>(std::move(backing_store));
+    JSValue value = JS_NewArrayBuffer(isolate->current_context_->context_, data, byte_length, BackingStoreHolderFree, holder, false);
+    if (JS_IsException(value)) {
+        //buffer没建起来，holder不会被回调释放
+        delete holder;
+        isolate->handleException();
+        return Local<ArrayBuffer>();
+    }
     ArrayBuffer *ab = isolate->Alloc<ArrayBuffer>();
-    ab->value_ = JS_NewArrayBuffer(isolate->current_context_->context_, (uint8_t*)data, byte_length, nullptr, nullptr, false);
+    ab->value_ = value;
     return Local<ArrayBuffer>(ab);
 }
 
+std::unique_ptr<BackingStore> ArrayBuffer::NewBackingStore(Isolate* isolate, size_t byte_length) {
+    std::unique_ptr<BackingStore> ret(new BackingStore);
+    ArrayBuffer::Allocator* allocator = isolate->array_buffer_allocator_;
+    //避免分配0字节，行为和平台相关
+    size_t size = byte_length > 0 ? byte_length : 1;
+    if (allocator) {
+        ret->data_ = allocator->Allocate(size);
+        ret->deleter_ = BackingStoreAllocatedDeleter;
+        ret->deleter_data_ = allocator;
+    } else {
+        ret->data_ = calloc(size, 1);
+        ret->deleter_ = BackingStoreFreeDeleter;
+    }
+    if (!ret->data_) {
+        //分配失败时返回长度为0、不持有内存的BackingStore，不能让ArrayBuffer指向空指针
+        ret->deleter_ = nullptr;
+        ret->deleter_data_ = nullptr;
+        return ret;
+    }
+    ret->byte_length_ = byte_length;
+    return ret;
+}
+
+std::unique_ptr<BackingStore> ArrayBuffer::NewBackingStore(void* data, size_t byte_length,
+                                                           BackingStore::DeleterCallback deleter, void* deleter_data) {
+    std::unique_ptr<BackingStore> ret(new BackingStore);
+    ret->data_ = data;
+    ret->byte_length_ = byte_length;
+    ret->deleter_ = deleter;
+    ret->deleter_data_ = deleter_data;
+    return ret;
+}
+
+//detach之后和V8一样返回空内容，不抛异常
 ArrayBuffer::Contents ArrayBuffer::GetContents() {
     ArrayBuffer::Contents ret;
-    ret.data_ = JS_GetArrayBuffer(Isolate::current_->current_context_->context_, &ret.byte_length_, value_);
+    uint8_t* data = nullptr;
+    JS_GetArrayBufferData(value_, &data, &ret.byte_length_);
+    ret.data_ = data;
     return ret;
 }
 
 std::shared_ptr<BackingStore> ArrayBuffer::GetBackingStore() {
-    BackingStore *ret = new BackingStore;
-    ret->data_ = JS_GetArrayBuffer(Isolate::current_->current_context_->context_, &ret->byte_length_, value_);
-    std::shared_ptr<BackingStore> ptr(ret);
-    return ptr;
+    void* opaque = nullptr;
+    if (JS_GetArrayBufferFreeFunc(value_, &opaque) == BackingStoreHolderFree) {
+        return *reinterpret_cast<std::shared_ptr<BackingStore>*>(opaque);
+    }
+    
+    //第一次取：把内存的所有权从buffer转到BackingStore，buffer改为持有它，之后都命中上面的缓存
+    Isolate* isolate = Isolate::GetCurrent();
+    JSContext* ctx = isolate->current_context_->context_;
+    std::shared_ptr<BackingStore> ret(new BackingStore);
+    uint8_t* data = nullptr;
+    JS_GetArrayBufferData(value_, &data, &ret->byte_length_);
+    ret->data_ = data;
+    auto holder = new std::shared_ptr<BackingStore>(ret);
+    JSFreeArrayBufferDataFunc* old_func = nullptr;
+    void* old_opaque = nullptr;
+    switch (JS_SetArrayBufferFreeFunc(ctx, value_, BackingStoreHolderFree, holder, &old_func, &old_opaque)) {
+    case JS_ARRAY_BUFFER_STORAGE_NONE:
+        break;
+    case JS_ARRAY_BUFFER_STORAGE_MALLOC:
+        //不是默认malloc时内存被挪到了新的malloc块里
+        JS_GetArrayBufferData(value_, &data, &ret->byte_length_);
+        ret->data_ = data;
+        ret->deleter_ = BackingStoreFreeDeleter;
+        break;
+    case JS_ARRAY_BUFFER_STORAGE_ALLOCATOR:
+        //opaque里是分配时的大小，从此不再计入isolate
+        isolate->array_buffer_allocated_bytes_ -= (size_t)(uintptr_t)old_opaque;
+        ret->deleter_ = BackingStoreAllocatedDeleter;
+        ret->deleter_data_ = isolate->array_buffer_allocator_;
+        break;
+    default:
+        //已经detach、不是ArrayBuffer或者内存不足，只返回当前内容
+        delete holder;
+        break;
+    }
+    return ret;
+}
+
+std::unique_ptr<BackingStore> SharedArrayBuffer::NewBackingStore(Isolate* isolate, size_t byte_length) {
+    //可能被别的isolate引用到最后，不走isolate自己的Allocator
+    size_t size = byte_length > 0 ? byte_length : 1;
+    void* data = calloc(size, 1);
+    if (!data) {
+        //分配失败返回不持有内存的空BackingStore，SharedArrayBuffer::New会拒绝它
+        std::unique_ptr<BackingStore> ret(new BackingStore);
+        ret->is_shared_ = true;
+        return ret;
+    }
+    return NewBackingStore(data, byte_length, BackingStoreFreeDeleter, nullptr);
+}
+
+std::unique_ptr<BackingStore> SharedArrayBuffer::NewBackingStore(void* data, size_t byte_length,
+                                                                 BackingStore::DeleterCallback deleter, void* deleter_data) {
+    std::unique_ptr<BackingStore> ret = ArrayBuffer::NewBackingStore(data, byte_length, deleter, deleter_data);
+    ret->is_shared_ = true;
+    return ret;
+}
+
+Local<SharedArrayBuffer> SharedArrayBuffer::New(Isolate* isolate, size_t byte_length) {
+    return New(isolate, NewBackingStore(isolate, byte_length));
+}
+
+Local<SharedArrayBuffer> SharedArrayBuffer::New(Isolate* isolate, std::shared_ptr<BackingStore> backing_store) {
+    V8::Check(!isolate->is_external_runtime_, "SharedArrayBuffer need a runtime created by Isolate!");
+    JSContext* ctx = isolate->current_context_->context_;
+    void* data = backing_store->Data();
+    if (!data) {
+        //登记表以内存地址为键，没有内存的BackingStore不能登记
+        JS_ThrowRangeError(ctx, "Array buffer allocation failed");
+        isolate->handleException();
+        return Local<SharedArrayBuffer>();
+    }
+    //先占一个引用，建对象时quickjs会再sab_dup一次，失败时也能正确释放
+    SharedMemoryRegister(backing_store);
+    JSValue value = JS_NewArrayBuffer(ctx, (uint8_t*)data, backing_store->ByteLength(), nullptr, nullptr, true);
+    SharedMemoryFree(nullptr, data);
+    if (JS_IsException(value)) {
+        isolate->handleException();
+        return Local<SharedArrayBuffer>();
+    }
+    SharedArrayBuffer* sab = isolate->Alloc<SharedArrayBuffer>();
+    sab->value_ = value;
+    return Local<SharedArrayBuffer>(sab);
+}
+
+size_t SharedArrayBuffer::ByteLength() {
+    uint8_t* data = nullptr;
+    size_t byte_length = 0;
+    JS_GetArrayBufferData(value_, &data, &byte_length);
+    return byte_length;
+}
+
+std::shared_ptr<BackingStore> SharedArrayBuffer::GetBackingStore() {
+    uint8_t* data = nullptr;
+    size_t byte_length = 0;
+    JS_GetArrayBufferData(value_, &data, &byte_length);
+    std::shared_ptr<BackingStore> ret = SharedMemoryFind(data);
+    if (!ret) {
+        //不是经过登记表分配的（外部runtime），只能返回不管理内存的BackingStore
+        ret.reset(new BackingStore);
+        ret->data_ = data;
+        ret->byte_length_ = byte_length;
+        ret->is_shared_ = true;
+    }
+    return ret;
 }
 
 Local<ArrayBuffer> ArrayBufferView::Buffer() {
-    Isolate* isolate = Isolate::current_;
+    Isolate* isolate = Isolate::GetCurrent();
+    //view已经detach时quickjs抛TypeError
+    JSValue value = JS_GetArrayBufferView(isolate->current_context_->context_, value_);
+    if (JS_IsException(value) || JS_IsUndefined(value)) {
+        isolate->handleException();
+        return Local<ArrayBuffer>();
+    }
     ArrayBuffer* ab = isolate->Alloc<ArrayBuffer>();
-    ab->value_ = JS_GetArrayBufferView(isolate->current_context_->context_, value_);
+    ab->value_ = value;
     return Local<ArrayBuffer>(ab);
 }
     
 size_t ArrayBufferView::ByteOffset() {
-    size_t byte_offset;
-    size_t byte_length;
-    size_t bytes_per_element;
-    JS_GetArrayBufferViewInfo(Isolate::current_->current_context_->context_, value_, &byte_offset, &byte_length, &bytes_per_element);
-    return byte_offset;
+    return GetContents().ByteOffset();
 }
     
 size_t ArrayBufferView::ByteLength() {
-    size_t byte_offset;
-    size_t byte_length;
-    size_t bytes_per_element;
-    JS_GetArrayBufferViewInfo(Isolate::current_->current_context_->context_, value_, &byte_offset, &byte_length, &bytes_per_element);
-    return byte_length;
+    return GetContents().ByteLength();
+}
+
+ArrayBufferView::Contents ArrayBufferView::GetContents() {
+    Contents ret;
+    uint8_t* data = nullptr;
+    if (JS_GetArrayBufferViewData(value_, &data, &ret.byte_offset_, &ret.byte_length_, nullptr)) {
+        ret.data_ = data;
+    }
+    return ret;
+}
+
+size_t ArrayBufferView::CopyContents(void* dest, size_t byte_length) {
+    Contents contents = GetContents();
+    size_t n = std::min(byte_length, contents.ByteLength());
+    if (n > 0) {
+        memcpy(dest, contents.Data(), n);
+    }
+    return n;
+}
+
+//按JS_TYPED_ARRAY_xxx下标
+static const uint8_t kTypedArrayElementSize[JS_TYPED_ARRAY_DATAVIEW + 1] = {1, 1, 1, 2, 2, 4, 4, 8, 8, 4, 8, 1};
+
+size_t TypedArray::Length() {
+    uint8_t* data = nullptr;
+    size_t byte_offset = 0;
+    size_t byte_length = 0;
+    int kind = JS_TYPED_ARRAY_UINT8;
+    JS_GetArrayBufferViewData(value_, &data, &byte_offset, &byte_length, &kind);
+    return byte_length / kTypedArrayElementSize[kind];
+}
+
+//偏移或者长度越界时quickjs抛RangeError，返回空
+template <typename T>
+static Local<T> NewTypedArray(Local<ArrayBuffer> array_buffer, size_t byte_offset, size_t length, int kind) {
+    Isolate* isolate = Isolate::GetCurrent();
+    JSValue value = JS_NewTypedArrayWithBuffer(isolate->current_context_->context_, array_buffer->value_, byte_offset, length, kind);
+    if (JS_IsException(value)) {
+        isolate->handleException();
+        return Local<T>();
+    }
+    T* ta = isolate->Alloc<T>();
+    ta->value_ = value;
+    return Local<T>(ta);
+}
+
+Local<Uint8Array> Uint8Array::New(Local<ArrayBuffer> array_buffer, size_t byte_offset, size_t length) {
+    return NewTypedArray<Uint8Array>(array_buffer, byte_offset, length, JS_TYPED_ARRAY_UINT8);
+}
+
+Local<Uint8ClampedArray> Uint8ClampedArray::New(Local<ArrayBuffer> array_buffer, size_t byte_offset, size_t length) {
+    return NewTypedArray<Uint8ClampedArray>(array_buffer, byte_offset, length, JS_TYPED_ARRAY_UINT8C);
+}
+
+Local<Int8Array> Int8Array::New(Local<ArrayBuffer> array_buffer, size_t byte_offset, size_t length) {
+    return NewTypedArray<Int8Array>(array_buffer, byte_offset, length, JS_TYPED_ARRAY_INT8);
+}
+
+Local<Uint16Array> Uint16Array::New(Local<ArrayBuffer> array_buffer, size_t byte_offset, size_t length) {
+    return NewTypedArray<Uint16Array>(array_buffer, byte_offset, length, JS_TYPED_ARRAY_UINT16);
+}
+
+Local<Int16Array> Int16Array::New(Local<ArrayBuffer> array_buffer, size_t byte_offset, size_t length) {
+    return NewTypedArray<Int16Array>(array_buffer, byte_offset, length, JS_TYPED_ARRAY_INT16);
+}
+
+Local<Uint32Array> Uint32Array::New(Local<ArrayBuffer> array_buffer, size_t byte_offset, size_t length) {
+    return NewTypedArray<Uint32Array>(array_buffer, byte_offset, length, JS_TYPED_ARRAY_UINT32);
+}
+
+Local<Int32Array> Int32Array::New(Local<ArrayBuffer> array_buffer, size_t byte_offset, size_t length) {
+    return NewTypedArray<Int32Array>(array_buffer, byte_offset, length, JS_TYPED_ARRAY_INT32);
+}
+
+Local<Float32Array> Float32Array::New(Local<ArrayBuffer> array_buffer, size_t byte_offset, size_t length) {
+    return NewTypedArray<Float32Array>(array_buffer, byte_offset, length, JS_TYPED_ARRAY_FLOAT32);
+}
+
+Local<Float64Array> Float64Array::New(Local<ArrayBuffer> array_buffer, size_t byte_offset, size_t length) {
+    return NewTypedArray<Float64Array>(array_buffer, byte_offset, length, JS_TYPED_ARRAY_FLOAT64);
+}
+
+Local<BigInt64Array> BigInt64Array::New(Local<ArrayBuffer> array_buffer, size_t byte_offset, size_t length) {
+    return NewTypedArray<BigInt64Array>(array_buffer, byte_offset, length, JS_TYPED_ARRAY_BIGINT64);
+}
+
+Local<BigUint64Array> BigUint64Array::New(Local<ArrayBuffer> array_buffer, size_t byte_offset, size_t length) {
+    return NewTypedArray<BigUint64Array>(array_buffer, byte_offset, length, JS_TYPED_ARRAY_BIGUINT64);
 }
 
 Local<Object> Context::Global() {
@@ -688,6 +2153,33 @@ Context::Context(Isolate* isolate, void* external_context) :isolate_(isolate) {
 }
 
 Context::~Context() {
+    for (auto function_template : function_templates_) {
+        function_template->ForgetContext(this);
+    }
+    function_templates_.clear();
+    //还活着的Script改为保存序列化的字节码，不再引用这个JSContext
+    while (!unbound_scripts_.empty()) {
+        UnboundScript* unbound_script = unbound_scripts_.back();
+        if (!unbound_script->BindTo(nullptr)) {
+            //序列化失败（OOM）只能放弃字节码，之后Run会失败
+            JS_FreeValue(context_, JS_GetException(context_));
+            JS_FreeValueRT(unbound_script->runtime_, unbound_script->function_bytecode_);
+            unbound_script->function_bytecode_ = JS_Undefined();
+            unbound_script->context_ = nullptr;
+            unbound_scripts_.pop_back();
+        }
+    }
+    //模块随JSContext一起释放，先放掉Module持有的引用
+    for (auto& local_module : modules_) {
+        Module* module = *local_module;
+        JSValue module_val;
+        JS_INITPTR(module_val, JS_TAG_MODULE, module->module_);
+        JS_FreeValue(context_, module_val);
+        module->module_ = nullptr;
+        module->context_ = nullptr;
+    }
+    modules_.clear();
+    module_names_.clear();
     JS_FreeValue(context_, global_);
     if (!is_external_context_) {
         JS_FreeContext(context_);
@@ -727,14 +2219,55 @@ MaybeLocal<Object> Function::NewInstance(Local<Context> context, int argc, Local
     }
 }
 
+//属性少时线性查找更快，超过这个数量后才建name -> 下标的索引，避免大模板的构建是O(n²)
+static const size_t kInfoIndexThreshold = 16;
+
+//同名的后设置覆盖先设置的，保持定义顺序
+template<typename T>
+static T& FindOrAppendInfo(std::vector<T>& infos, std::unordered_map<std::string, size_t>& index, const char* name) {
+    if (infos.size() < kInfoIndexThreshold) {
+        for (auto& info : infos) {
+            if (info.name_ == name) {
+                return info;
+            }
+        }
+    } else {
+        if (index.empty()) {
+            for (size_t i = 0; i < infos.size(); i++) {
+                index.emplace(infos[i].name_, i);
+            }
+        }
+        auto iter = index.find(name);
+        if (iter != index.end()) {
+            return infos[iter->second];
+        }
+        index.emplace(name, infos.size());
+    }
+    infos.emplace_back();
+    infos.back().name_ = name;
+    infos.back().atom_ = JS_ATOM_NULL;
+    return infos.back();
+}
+
+template<typename T>
+static void FreeInfoAtoms(JSRuntime* rt, std::vector<T>& infos) {
+    if (!rt) return;
+    for (auto& info : infos) {
+        if (info.atom_ != JS_ATOM_NULL) {
+            JS_FreeAtomRT(rt, info.atom_);
+            info.atom_ = JS_ATOM_NULL;
+        }
+    }
+}
+
 void Template::Set(Isolate* isolate, const char* name, Local<Data> value) {
-    fields_[name] = value;
+    FindOrAppendInfo(fields_, fields_index_, name).value_ = value;
 }
 
 void Template::Set(Local<Name> name, Local<Data> value,
                    PropertyAttribute attributes) {
-    Isolate* isolate = Isolate::current_;
-    Set(isolate, *String::Utf8Value(Isolate::current_, name), value);
+    Isolate* isolate = Isolate::GetCurrent();
+    Set(isolate, *String::Utf8Value(Isolate::GetCurrent(), name), value);
 }
     
 void Template::SetAccessorProperty(Local<Name> name,
@@ -742,48 +2275,61 @@ void Template::SetAccessorProperty(Local<Name> name,
                                          Local<FunctionTemplate> setter,
                                          PropertyAttribute attribute) {
     
-    accessor_property_infos_[*String::Utf8Value(Isolate::current_, name)] = {getter, setter, attribute};
+    AccessorPropertyInfo& info = FindOrAppendInfo(accessor_property_infos_, accessor_property_index_, *String::Utf8Value(Isolate::GetCurrent(), name));
+    info.getter_ = getter;
+    info.setter_ = setter;
+    info.attribute_ = attribute;
+}
+
+JSAtom Template::InternAtom(JSContext* ctx, const std::string& name, JSAtom& atom) {
+    if (atom == JS_ATOM_NULL) {
+        atom = JS_NewAtomLen(ctx, name.data(), name.size());
+        atom_runtime_ = JS_GetRuntime(ctx);
+    }
+    return atom;
+}
+
+Template::~Template() {
+    FreeInfoAtoms(atom_runtime_, fields_);
+    FreeInfoAtoms(atom_runtime_, accessor_property_infos_);
 }
 
 void Template::InitPropertys(Local<Context> context, JSValue obj) {
-    for(auto it : fields_) {
-        JSAtom atom = JS_NewAtom(context->context_, it.first.data());
-        Local<FunctionTemplate> funcTpl = Local<FunctionTemplate>::Cast(it.second);
+    for (auto& info : fields_) {
+        JSAtom atom = InternAtom(context->context_, info.name_, info.atom_);
+        Local<FunctionTemplate> funcTpl = Local<FunctionTemplate>::Cast(info.value_);
         Local<Function> lfunc = funcTpl->GetFunction(context).ToLocalChecked();
         context->GetIsolate()->Escape(*lfunc);
         JS_DefinePropertyValue(context->context_, obj, atom, lfunc->value_, JS_PROP_CONFIGURABLE | JS_PROP_ENUMERABLE | JS_PROP_WRITABLE);
-        JS_FreeAtom(context->context_, atom);
     }
     
-    for (auto it : accessor_property_infos_) {
+    for (auto& info : accessor_property_infos_) {
         JSValue getter = JS_Undefined();
         JSValue setter = JS_Undefined();
         int flag = 0;
-        if (!(it.second.attribute_ & DontDelete)) {
+        if (!(info.attribute_ & DontDelete)) {
             flag |= JS_PROP_CONFIGURABLE;
         }
-        if (!(it.second.attribute_ & DontEnum)) {
+        if (!(info.attribute_ & DontEnum)) {
             flag |= JS_PROP_ENUMERABLE;
         }
         
-        std::string name = it.first;
-        if (!it.second.getter_.IsEmpty()) {
+        if (!info.getter_.IsEmpty()) {
             flag |= JS_PROP_HAS_GET;
-            Local<Function> gfunc = it.second.getter_->GetFunction(context).ToLocalChecked();
+            Local<Function> gfunc = info.getter_->GetFunction(context).ToLocalChecked();
             context->GetIsolate()->Escape(*gfunc);
             getter = gfunc->value_;
         }
         
-        if (!(it.second.attribute_ & ReadOnly) && !it.second.setter_.IsEmpty()) {
+        if (!(info.attribute_ & ReadOnly) && !info.setter_.IsEmpty()) {
             flag |= JS_PROP_HAS_SET;
             flag |= JS_PROP_WRITABLE;
-            Local<Function> sfunc = it.second.setter_->GetFunction(context).ToLocalChecked();
+            Local<Function> sfunc = info.setter_->GetFunction(context).ToLocalChecked();
             context->GetIsolate()->Escape(*sfunc);
             setter = sfunc->value_;
         }
-        JSAtom atom = JS_NewAtom(context->context_, name.c_str());
+        JSAtom atom = InternAtom(context->context_, info.name_, info.atom_);
         JS_DefineProperty(context->context_, obj, atom, JS_Undefined(), getter, setter, flag);
-        JS_FreeAtom(context->context_, atom);
         JS_FreeValue(context->context_, getter);
         JS_FreeValue(context->context_, setter);
     }
@@ -793,86 +2339,134 @@ void ObjectTemplate::SetAccessor(Local<Name> name, AccessorNameGetterCallback ge
                                  AccessorNameSetterCallback setter,
                                  Local<Value> data, AccessControl settings,
                                  PropertyAttribute attribute) {
-    JSValue js_data = data.IsEmpty() ? JS_Undefined() : data->value_;
-    accessor_infos_[*String::Utf8Value(Isolate::current_, name)] = {getter, setter, js_data, settings, attribute};
+    Isolate* isolate = Isolate::GetCurrent();
+    AccessorInfo& info = FindOrAppendInfo(accessor_infos_, accessor_index_, *String::Utf8Value(isolate, name));
+    accessor_runtime_ = isolate->runtime_;
+    //覆盖同名访问器：已经创建的闭包继续持有旧的AccessorData，模板这边换成新的
+    JS_FreeValueRT(accessor_runtime_, info.data_);
+    JS_FreeValueRT(accessor_runtime_, info.holder_);
+    info.getter_ = getter;
+    info.setter_ = setter;
+    info.data_ = data.IsEmpty() ? JS_Undefined() : JS_DupValueRT(accessor_runtime_, data->value_);
+    info.settings_ = settings;
+    info.attribute_ = attribute;
+    info.holder_ = JS_Undefined();
+}
+
+ObjectTemplate::~ObjectTemplate() {
+    FreeInfoAtoms(atom_runtime_, accessor_infos_);
+    if (accessor_runtime_) {
+        for (auto& info : accessor_infos_) {
+            JS_FreeValueRT(accessor_runtime_, info.data_);
+            JS_FreeValueRT(accessor_runtime_, info.holder_);
+        }
+    }
+}
+
+//所有访问器共享这两个入口，accessor由闭包持有的AccessorData对象保证存活
+static JSValue AccessorGetterTrampoline(JSContext *ctx, JSValueConst this_val, const ObjectTemplate::AccessorData* accessor) {
+    Isolate* isolate = reinterpret_cast<Context*>(JS_GetContextOpaque(ctx))->GetIsolate();
+    
+    PropertyCallbackInfo<Value> callbackInfo;
+    callbackInfo.isolate_ = isolate;
+    callbackInfo.context_ = ctx;
+    callbackInfo.this_ = this_val;
+    callbackInfo.data_ = accessor->data_;
+    callbackInfo.value_ = JS_Undefined();
+    
+    JSValue name = accessor->name_;
+    accessor->getter_(Local<String>(reinterpret_cast<String*>(&name)), callbackInfo);
+    
+    if (V8_UNLIKELY(isolate->HasPendingException())) {
+        JS_FreeValue(ctx, callbackInfo.value_);
+        return JS_EXCEPTION;
+    }
+    
+    return callbackInfo.value_;
+}
+
+static JSValue AccessorSetterTrampoline(JSContext *ctx, JSValueConst this_val, JSValueConst val, const ObjectTemplate::AccessorData* accessor) {
+    Isolate* isolate = reinterpret_cast<Context*>(JS_GetContextOpaque(ctx))->GetIsolate();
+    
+    PropertyCallbackInfo<void> callbackInfo;
+    callbackInfo.isolate_ = isolate;
+    callbackInfo.context_ = ctx;
+    callbackInfo.this_ = this_val;
+    callbackInfo.data_ = accessor->data_;
+    callbackInfo.value_ = JS_Undefined();
+    
+    JSValue name = accessor->name_;
+    accessor->setter_(Local<String>(reinterpret_cast<String*>(&name)), Local<Value>(reinterpret_cast<Value*>(&val)), callbackInfo);
+    
+    if (V8_UNLIKELY(isolate->HasPendingException())) {
+        JS_FreeValue(ctx, callbackInfo.value_);
+        return JS_EXCEPTION;
+    }
+    
+    return callbackInfo.value_;
+}
+
+//闭包带上AccessorData对象（保证存活）和它的指针（调用时直接取，不用JS_GetOpaque）
+//（试过magic索引的JS_CFUNC_getter_magic，内存更省，但走js_call_c_function调用反而更慢）
+static JSValue NewAccessorFunction(JSContext *ctx, JSValueConst holder, bool is_setter) {
+    JSValue func_data[2];
+    func_data[0] = holder;
+    JS_INITPTR(func_data[1], JS_TAG_EXTERNAL, JS_GetOpaque(holder, reinterpret_cast<Context*>(JS_GetContextOpaque(ctx))->GetIsolate()->accessor_data_class_id_));
+    if (is_setter) {
+        return JS_NewCFunctionData(ctx, [](JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv, int magic, JSValue *func_data) {
+            return AccessorSetterTrampoline(ctx, this_val, argv[0], reinterpret_cast<const ObjectTemplate::AccessorData*>(JS_VALUE_GET_PTR(func_data[1])));
+        }, 1, 0, 2, &func_data[0]);
+    } else {
+        return JS_NewCFunctionData(ctx, [](JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv, int magic, JSValue *func_data) {
+            return AccessorGetterTrampoline(ctx, this_val, reinterpret_cast<const ObjectTemplate::AccessorData*>(JS_VALUE_GET_PTR(func_data[1])));
+        }, 0, 0, 2, &func_data[0]);
+    }
 }
 
 void ObjectTemplate::InitAccessors(Local<Context> context, JSValue obj) {
-    for (auto it : accessor_infos_) {
+    Isolate* isolate = context->GetIsolate();
+    for (auto& info : accessor_infos_) {
         JSValue getter = JS_Undefined();
         JSValue setter = JS_Undefined();
         int flag = 0;
-        if (!(it.second.attribute_ & DontDelete)) {
+        if (!(info.attribute_ & DontDelete)) {
             flag |= JS_PROP_CONFIGURABLE;
         }
-        if (!(it.second.attribute_ & DontEnum)) {
+        if (!(info.attribute_ & DontEnum)) {
             flag |= JS_PROP_ENUMERABLE;
         }
         
-        std::string name = it.first;
+        JSAtom atom = InternAtom(context->context_, info.name_, info.atom_);
         
-        auto name_val = String::NewFromUtf8(context->GetIsolate(), name.c_str()).ToLocalChecked();
-        
-        JSValue func_data[] = {JS_Undefined(), name_val->value_, it.second.data_};
+        if (JS_IsUndefined(info.holder_)) {
+            JSValue holder = JS_NewObjectClass(context->context_, isolate->accessor_data_class_id_);
+            if (JS_IsException(holder)) {
+                continue;
+            }
+            AccessorData* accessor = reinterpret_cast<AccessorData*>(js_malloc(context->context_, sizeof(AccessorData)));
+            if (!accessor) {
+                JS_FreeValue(context->context_, holder);
+                continue;
+            }
+            accessor->getter_ = info.getter_;
+            accessor->setter_ = info.setter_;
+            accessor->data_ = JS_DupValueRT(isolate->runtime_, info.data_);
+            accessor->name_ = JS_AtomToString(context->context_, atom);
+            JS_SetOpaque(holder, accessor);
+            info.holder_ = holder;
+        }
         
-        if (it.second.getter_) {
+        if (info.getter_) {
             flag |= JS_PROP_HAS_GET;
-            JS_INITPTR(func_data[0], JS_TAG_EXTERNAL, (void*)it.second.getter_);
-            getter = JS_NewCFunctionData(context->context_, [](JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv, int magic, JSValue *func_data) {
-                Isolate* isolate = reinterpret_cast<Context*>(JS_GetContextOpaque(ctx))->GetIsolate();
-                
-                PropertyCallbackInfo<Value> callbackInfo;
-                callbackInfo.isolate_ = isolate;
-                callbackInfo.context_ = ctx;
-                callbackInfo.this_ = this_val;
-                callbackInfo.data_ = func_data[2];
-                callbackInfo.value_ = JS_Undefined();
-                
-                String *key = reinterpret_cast<String*>(&func_data[1]);
-                AccessorNameGetterCallback callback = (AccessorNameGetterCallback)(JS_VALUE_GET_PTR(func_data[0]));
-                callback(Local<String>(key), callbackInfo);
-                
-                if (!JS_IsUndefined(isolate->exception_)) {
-                    JSValue ex = isolate->exception_;
-                    isolate->exception_ = JS_Undefined();
-                    return JS_Throw(ctx, ex);
-                }
-                
-                return callbackInfo.value_;
-            }, 0, 0, 3, &func_data[0]);
+            getter = NewAccessorFunction(context->context_, info.holder_, false);
         }
         
-        if (!(it.second.attribute_ & ReadOnly) && it.second.setter_) {
+        if (!(info.attribute_ & ReadOnly) && info.setter_) {
             flag |= JS_PROP_HAS_SET;
             flag |= JS_PROP_WRITABLE;
-            JS_INITPTR(func_data[0], JS_TAG_EXTERNAL, (void*)it.second.setter_);
-            setter = JS_NewCFunctionData(context->context_, [](JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv, int magic, JSValue *func_data) {
-                Isolate* isolate = reinterpret_cast<Context*>(JS_GetContextOpaque(ctx))->GetIsolate();
-                
-                PropertyCallbackInfo<void> callbackInfo;
-                callbackInfo.isolate_ = isolate;
-                callbackInfo.context_ = ctx;
-                callbackInfo.this_ = this_val;
-                callbackInfo.data_ = func_data[2];
-                callbackInfo.value_ = JS_Undefined();
-                
-                String *key = reinterpret_cast<String*>(&func_data[1]);
-                Value *val = reinterpret_cast<Value*>(argv);
-                AccessorNameSetterCallback callback = (AccessorNameSetterCallback)(JS_VALUE_GET_PTR(func_data[0]));
-                callback(Local<String>(key), Local<Value>(val), callbackInfo);
-                
-                if (!JS_IsUndefined(isolate->exception_)) {
-                    JSValue ex = isolate->exception_;
-                    isolate->exception_ = JS_Undefined();
-                    return JS_Throw(ctx, ex);
-                }
-                
-                return callbackInfo.value_;
-            }, 0, 0, 3, &func_data[0]);
+            setter = NewAccessorFunction(context->context_, info.holder_, true);
         }
-        JSAtom atom = JS_NewAtom(context->context_, name.c_str());
         JS_DefineProperty(context->context_, obj, atom, JS_Undefined(), getter, setter, flag);
-        JS_FreeAtom(context->context_, atom);
         JS_FreeValue(context->context_, getter);
         JS_FreeValue(context->context_, setter);
     }
@@ -891,9 +2485,11 @@ Local<FunctionTemplate> FunctionTemplate::New(Isolate* isolate, FunctionCallback
         functionTemplate->cfunction_data_.data_ = data->value_;
     }
     functionTemplate->cfunction_data_.callback_ = callback;
+    functionTemplate->cfunction_data_.template_chain_ = nullptr;
     
     //isolate->RegFunctionTemplate(functionTemplate);
     functionTemplate->isolate_ = isolate;
+    functionTemplate->template_id_ = ++isolate->next_template_id_;
     return functionTemplate;
 }
 
@@ -906,6 +2502,23 @@ Local<ObjectTemplate> FunctionTemplate::InstanceTemplate() {
     
 void FunctionTemplate::Inherit(Local<FunctionTemplate> parent) {
     parent_ = parent;
+    template_chain_ = nullptr;
+}
+
+const uint32_t* FunctionTemplate::TemplateChain() {
+    if (!template_chain_) {
+        const uint32_t* parent_chain = parent_.IsEmpty() ? nullptr : parent_->TemplateChain();
+        template_depth_ = parent_chain ? parent_chain[0] : 0;
+        uint32_t* chain = new uint32_t[template_depth_ + 2];
+        chain[0] = template_depth_ + 1;
+        for (uint32_t i = 1; i <= template_depth_; i++) {
+            chain[i] = parent_chain[i];
+        }
+        chain[template_depth_ + 1] = template_id_;
+        isolate_->template_chains_.push_back(chain);
+        template_chain_ = chain;
+    }
+    return template_chain_;
 }
     
 Local<ObjectTemplate> FunctionTemplate::PrototypeTemplate() {
@@ -916,63 +2529,98 @@ Local<ObjectTemplate> FunctionTemplate::PrototypeTemplate() {
 }
 
 MaybeLocal<Function> FunctionTemplate::GetFunction(Local<Context> context) {
-    auto iter = context_to_funtion_.find(*context);
-    if (iter != context_to_funtion_.end()) {
+    if (last_context_ != *context) {
+        auto iter = context_to_funtion_.find(*context);
+        if (iter != context_to_funtion_.end()) {
+            last_context_ = iter->first;
+            last_function_ = iter->second;
+        }
+    }
+    if (last_context_ == *context) {
         Function* ret = isolate_->Alloc<Function>();
-        ret->value_ = iter->second;
+        ret->value_ = last_function_;
         JS_DupValueRT(isolate_->runtime_, ret->value_);
         return MaybeLocal<Function>(Local<Function>(ret));
     }
     cfunction_data_.is_construtor_ = !prototype_template_.IsEmpty() || !instance_template_.IsEmpty() || fields_.size() > 0 || accessor_property_infos_.size() > 0 || !parent_.IsEmpty();
     cfunction_data_.internal_field_count_ = instance_template_.IsEmpty() ? 0 : instance_template_->internal_field_count_;
+    cfunction_data_.template_chain_ = TemplateChain();
+    
+    //callback、internal_field_count等在创建函数时就确定了，这里一次性算好，调用时直接读取
+    FunctionTemplate::CFunctionData* cdata = reinterpret_cast<FunctionTemplate::CFunctionData*>(js_malloc(context->context_, sizeof(CFunctionData)));
+    if (!cdata) {
+        //js_malloc失败时已经抛出了OOM异常
+        isolate_->handleException();
+        return MaybeLocal<Function>();
+    }
+    *cdata = cfunction_data_;
+    JS_DupValueRT(isolate_->runtime_, cdata->data_);
     
-    JSValue func_data[4];
-    JS_INITPTR(func_data[0], JS_TAG_EXTERNAL, (void*)cfunction_data_.callback_);
-    func_data[1] = JS_NewInt32_(context->context_, cfunction_data_.internal_field_count_);
-    func_data[2] = cfunction_data_.data_;
-    func_data[3] = cfunction_data_.is_construtor_ ? JS_True() : JS_False();
+    JSValue func_data[2];
+    func_data[0] = JS_NewObjectClass(context->context_, isolate_->function_data_class_id_);
+    if (JS_IsException(func_data[0])) {
+        JS_FreeValueRT(isolate_->runtime_, cdata->data_);
+        js_free(context->context_, cdata);
+        isolate_->handleException();
+        return MaybeLocal<Function>();
+    }
+    JS_SetOpaque(func_data[0], cdata);
+    JS_INITPTR(func_data[1], JS_TAG_EXTERNAL, (void*)cdata);
     
     JSValue func = JS_NewCFunctionData(context->context_, [](JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv, int magic, JSValue *func_data) {
         Isolate* isolate = reinterpret_cast<Context*>(JS_GetContextOpaque(ctx))->GetIsolate();
-        FunctionCallback callback = (FunctionCallback)(JS_VALUE_GET_PTR(func_data[0]));
-        int32_t internal_field_count;
-        JS_ToInt32(ctx, &internal_field_count, func_data[1]);
+        const FunctionTemplate::CFunctionData* cdata = reinterpret_cast<const FunctionTemplate::CFunctionData*>(JS_VALUE_GET_PTR(func_data[1]));
+        int32_t internal_field_count = cdata->internal_field_count_;
         FunctionCallbackInfo<Value> callbackInfo;
         callbackInfo.isolate_ = isolate;
         callbackInfo.argc_ = argc;
         callbackInfo.argv_ = argv;
         callbackInfo.context_ = ctx;
         callbackInfo.this_ = this_val;
-        callbackInfo.data_ = func_data[2];
+        callbackInfo.data_ = cdata->data_;
         callbackInfo.value_ = JS_Undefined();
         //JS_IsConstructor(ctx, this_val)，静态方法的话，用JS_IsConstructor会返回true，其父节点对象是构造函数，这个就是构造函数？
-        callbackInfo.isConstructCall = JS_ToBool(ctx, func_data[3]);
+        callbackInfo.isConstructCall = cdata->is_construtor_;
         
         if (callbackInfo.isConstructCall && internal_field_count > 0) {
             JSValue proto = JS_GetProperty(ctx, this_val, JS_ATOM_prototype);
+            if (JS_IsException(proto)) {
+                return JS_EXCEPTION;
+            }
             callbackInfo.this_ = JS_NewObjectProtoClass(ctx, proto, isolate->class_id_);
             JS_FreeValue(ctx, proto);
+            if (JS_IsException(callbackInfo.this_)) {
+                return JS_EXCEPTION;
+            }
             size_t size = sizeof(ObjectUserData) + sizeof(void*) * (internal_field_count - 1);
-            ObjectUserData* object_udata = (ObjectUserData*)js_malloc(ctx, size);
-            memset(object_udata, 0, size);
+            ObjectUserData* object_udata = (ObjectUserData*)js_mallocz(ctx, size);
+            if (!object_udata) {
+                JS_FreeValue(ctx, callbackInfo.this_);
+                return JS_EXCEPTION;
+            }
             object_udata->len_ = internal_field_count;
+            object_udata->template_chain_ = cdata->template_chain_;
             JS_SetOpaque(callbackInfo.this_, object_udata);
         }
         
-        callback(callbackInfo);
+        cdata->callback_(callbackInfo);
         
-        if (!JS_IsUndefined(isolate->exception_)) {
+        if (V8_UNLIKELY(isolate->HasPendingException())) {
             if (callbackInfo.isConstructCall && internal_field_count > 0) {
                 JS_FreeValue(ctx, callbackInfo.this_);
             }
-            JSValue ex = isolate->exception_;
-            isolate->exception_ = JS_Undefined();
-            //isolate->Escape(&ex);
-            return JS_Throw(ctx, ex);
+            JS_FreeValue(ctx, callbackInfo.value_);
+            return JS_EXCEPTION;
         }
         
         return callbackInfo.isConstructCall ? callbackInfo.this_ : callbackInfo.value_;
-    }, 0, 0, 4, &func_data[0]);
+    }, 0, 0, 2, &func_data[0]);
+    //cdata随func_data[0]释放
+    JS_FreeValue(context->context_, func_data[0]);
+    if (JS_IsException(func)) {
+        isolate_->handleException();
+        return MaybeLocal<Function>();
+    }
     
     if (cfunction_data_.is_construtor_) {
         JS_SetConstructorBit(context->context_, func, 1);
@@ -1000,76 +2648,108 @@ MaybeLocal<Function> FunctionTemplate::GetFunction(Local<Context> context) {
     
     context_to_funtion_[*context] = func;
     JS_DupValueRT(isolate_->runtime_, func);
+    context->function_templates_.push_back(this);
+    last_context_ = *context;
+    last_function_ = func;
     
     return MaybeLocal<Function>(ret);
 }
 
+void FunctionTemplate::ForgetContext(Context* context) {
+    auto iter = context_to_funtion_.find(context);
+    if (iter != context_to_funtion_.end()) {
+        JS_FreeValueRT(isolate_->runtime_, iter->second);
+        context_to_funtion_.erase(iter);
+    }
+    if (last_context_ == context) {
+        last_context_ = nullptr;
+    }
+}
+
 bool FunctionTemplate::HasInstance(Local<Value> object) {
-    auto Context = Isolate::current_->GetCurrentContext();
+    //由模板构造的对象直接比较id链，不用走原型链
+    ObjectUserData* objectUdata = reinterpret_cast<ObjectUserData*>(JS_GetOpaque(object->value_, isolate_->class_id_));
+    if (objectUdata && objectUdata->template_chain_) {
+        const uint32_t* chain = objectUdata->template_chain_;
+        TemplateChain();
+        return chain[0] > template_depth_ && chain[template_depth_ + 1] == template_id_;
+    }
+    
+    auto Context = Isolate::GetCurrent()->GetCurrentContext();
     auto Func = GetFunction(Context).ToLocalChecked();
-    int b = JS_IsInstanceOf(Isolate::current_->GetCurrentContext()->context_, object->value_, Func->value_);
-    if (b < 0) return false;
+    int b = JS_IsInstanceOf(Isolate::GetCurrent()->GetCurrentContext()->context_, object->value_, Func->value_);
+    if (b < 0) {
+        isolate_->handleException();
+        return false;
+    }
     return (bool)b;
 }
 
 FunctionTemplate::~FunctionTemplate() {
     for(auto it : context_to_funtion_) {
+        auto& function_templates = it.first->function_templates_;
+        function_templates.erase(std::remove(function_templates.begin(), function_templates.end(), this), function_templates.end());
         JS_FreeValueRT(isolate_->runtime_, it.second);
     }
 }
 
+//setter、Proxy或者只读属性（严格模式）抛出的异常交给TryCatch，返回Nothing
+static V8_INLINE Maybe<bool> ProcessSetResult(Isolate* isolate, int ret) {
+    if (ret < 0) {
+        isolate->handleException();
+        return Maybe<bool>();
+    }
+    return Maybe<bool>(ret != 0);
+}
+
 Maybe<bool> Object::Set(Local<Context> context,
                         Local<Value> key, Local<Value> value) {
-    bool ok = false;
-    context->GetIsolate()->Escape(*value);
     if (key->IsNumber()) {
-        ok = JS_SetPropertyUint32(context->context_, value_, key->Uint32Value(context).ToChecked(), value->value_);
-    } else {
-        JSAtom atom = JS_ValueToAtom(context->context_, key->value_);
-        ok = JS_SetProperty(context->context_, value_, atom, value->value_);
-        JS_FreeAtom(context->context_, atom);
+        return Set(context, key->Uint32Value(context).ToChecked(), value);
     }
-    
-    return Maybe<bool>(ok);
+    Isolate* isolate = context->GetIsolate();
+    //key转atom时可能调用toString并抛出异常
+    JSAtom atom = JS_ValueToAtomFast(context->context_, key->value_);
+    if (atom == JS_ATOM_NULL) {
+        isolate->handleException();
+        return Maybe<bool>();
+    }
+    isolate->Escape(*value);
+    int ret = JS_SetProperty(context->context_, value_, atom, value->value_);
+    JS_FreeAtom(context->context_, atom);
+    return ProcessSetResult(isolate, ret);
 }
 
 Maybe<bool> Object::Set(Local<Context> context,
                 uint32_t index, Local<Value> value) {
-    bool ok = false;
     context->GetIsolate()->Escape(*value);
-    
-    ok = JS_SetPropertyUint32(context->context_, value_, index, value->value_);
-    
-    return Maybe<bool>(ok);
+    return ProcessSetResult(context->GetIsolate(), JS_SetPropertyUint32(context->context_, value_, index, value->value_));
 }
 
 MaybeLocal<Value> Object::Get(Local<Context> context,
                       Local<Value> key) {
-    Value* ret = context->GetIsolate()->Alloc<Value>();
-    
     if (key->IsNumber()) {
-        ret->value_ = JS_GetPropertyUint32(context->context_, value_, key->Uint32Value(context).ToChecked());
-    } else {
-        JSAtom atom = JS_ValueToAtom(context->context_, key->value_);
-        ret->value_ = JS_GetProperty(context->context_, value_, atom);
-        JS_FreeAtom(context->context_, atom);
+        return Get(context, key->Uint32Value(context).ToChecked());
     }
-    
-    return MaybeLocal<Value>(Local<Value>(ret));
+    JSAtom atom = JS_ValueToAtomFast(context->context_, key->value_);
+    if (atom == JS_ATOM_NULL) {
+        context->GetIsolate()->handleException();
+        return MaybeLocal<Value>();
+    }
+    JSValue value = JS_GetProperty(context->context_, value_, atom);
+    JS_FreeAtom(context->context_, atom);
+    return ProcessResult(context->GetIsolate(), value);
 }
 
 MaybeLocal<Value> Object::Get(Local<Context> context,
                               uint32_t index) {
-    Value* ret = context->GetIsolate()->Alloc<Value>();
-    
-    ret->value_ = JS_GetPropertyUint32(context->context_, value_, index);
-    
-    return MaybeLocal<Value>(Local<Value>(ret));
+    return ProcessResult(context->GetIsolate(), JS_GetPropertyUint32(context->context_, value_, index));
 }
 
 MaybeLocal<Array> Object::GetOwnPropertyNames(Local<Context> context) {
     auto properties = JS_GetOwnPropertyNamesAsArray(context->context_, value_);
     if (JS_IsException(properties)) {
+        context->GetIsolate()->handleException();
         return MaybeLocal<Array>();
     }
     
@@ -1082,34 +2762,47 @@ MaybeLocal<Array> Object::GetOwnPropertyNames(Local<Context> context) {
 
 Maybe<bool> Object::HasOwnProperty(Local<Context> context,
                                    Local<Name> key) {
-    JSAtom atom = JS_ValueToAtom(context->context_, key->value_);
-    int ret = JS_GetOwnProperty(Isolate::current_->GetCurrentContext()->context_, nullptr, value_, atom);
+    JSAtom atom = JS_ValueToAtomFast(context->context_, key->value_);
+    if (atom == JS_ATOM_NULL) {
+        context->GetIsolate()->handleException();
+        return Maybe<bool>();
+    }
+    int ret = JS_GetOwnProperty(Isolate::GetCurrent()->GetCurrentContext()->context_, nullptr, value_, atom);
     JS_FreeAtom(context->context_, atom);
     if (ret < 0) {
+        context->GetIsolate()->handleException();
         return Maybe<bool>();
     } else {
         return Maybe<bool>((bool)ret);
     }
 }
 
+//Proxy的getPrototypeOf可能抛出异常
 Local<Value> Object::GetPrototype() {
-    auto val = JS_GetPrototype(Isolate::current_->GetCurrentContext()->context_, value_);
-    Value* ret = Isolate::current_->Alloc<Value>();
+    Isolate* isolate = Isolate::GetCurrent();
+    auto val = JS_GetPrototype(isolate->GetCurrentContext()->context_, value_);
+    if (JS_IsException(val)) {
+        isolate->handleException();
+        return Local<Value>();
+    }
+    Value* ret = isolate->Alloc<Value>();
     ret->value_ = val;
     return Local<Value>(ret);
 }
 
+//原型链成环、对象不可扩展等会抛出TypeError，和V8一样返回Nothing
 Maybe<bool> Object::SetPrototype(Local<Context> context,
                                  Local<Value> prototype) {
-    if (JS_SetPrototype(Isolate::current_->GetCurrentContext()->context_, value_, prototype->value_) < 0) {
-        return Maybe<bool>(false);
+    if (JS_SetPrototype(Isolate::GetCurrent()->GetCurrentContext()->context_, value_, prototype->value_) < 0) {
+        context->GetIsolate()->handleException();
+        return Maybe<bool>();
     } else {
         return Maybe<bool>(true);
     }
 }
 
 void Object::SetAlignedPointerInInternalField(int index, void* value) {
-    ObjectUserData* objectUdata = reinterpret_cast<ObjectUserData*>(JS_GetOpaque(value_, Isolate::current_->class_id_));
+    ObjectUserData* objectUdata = reinterpret_cast<ObjectUserData*>(JS_GetOpaque(value_, Isolate::GetCurrent()->class_id_));
     //if (index == 0) std::cout << "SetAlignedPointerInInternalField, value:" << value << ", objptr:" << JS_VALUE_GET_PTR(value_) << std::endl;
     if (!objectUdata || index >= objectUdata->len_) {
         std::cerr << "SetAlignedPointerInInternalField";
@@ -1126,7 +2819,7 @@ void Object::SetAlignedPointerInInternalField(int index, void* value) {
 }
     
 void* Object::GetAlignedPointerFromInternalField(int index) {
-    ObjectUserData* objectUdata = reinterpret_cast<ObjectUserData*>(JS_GetOpaque(value_, Isolate::current_->class_id_));
+    ObjectUserData* objectUdata = reinterpret_cast<ObjectUserData*>(JS_GetOpaque(value_, Isolate::GetCurrent()->class_id_));
     
     bool noObjectUdata = IsFunction() || objectUdata == nullptr;
 
@@ -1145,7 +2838,7 @@ void* Object::GetAlignedPointerFromInternalField(int index) {
 }
 
 int Object::InternalFieldCount() {
-    ObjectUserData* objectUdata = reinterpret_cast<ObjectUserData*>(JS_GetOpaque(value_, Isolate::current_->class_id_));
+    ObjectUserData* objectUdata = reinterpret_cast<ObjectUserData*>(JS_GetOpaque(value_, Isolate::GetCurrent()->class_id_));
     
     bool noObjectUdata = IsFunction() || objectUdata == nullptr;
 
@@ -1156,19 +2849,24 @@ int Object::InternalFieldCount() {
 }
 
 Local<Object> Object::New(Isolate* isolate) {
+    JSValue value = JS_NewObject(isolate->GetCurrentContext()->context_);
+    if (JS_IsException(value)) {
+        isolate->handleException();
+        return Local<Object>();
+    }
     Object *object = isolate->Alloc<Object>();
-    object->value_ = JS_NewObject(isolate->GetCurrentContext()->context_);
+    object->value_ = value;
     return Local<Object>(object);
 }
 
 uint32_t Array::Length() const {
-    auto context = Isolate::current_->GetCurrentContext()->context_;
+    auto context = Isolate::GetCurrent()->GetCurrentContext()->context_;
     auto len = JS_GetProperty(context, value_, JS_ATOM_length);
-    if (JS_IsException(len)) {
-        return 0;
+    uint32_t ret = 0;
+    if (JS_IsException(len) || JS_ToUint32(context, &ret, len) < 0) {
+        Isolate::GetCurrent()->handleException();
+        ret = 0;
     }
-    uint32_t ret;
-    JS_ToUint32(context, &ret, len);
     JS_FreeValue(context, len);
     return ret;
 }
@@ -1176,6 +2874,8 @@ uint32_t Array::Length() const {
 TryCatch::TryCatch(Isolate* isolate) {
     isolate_ = isolate;
     catched_ = JS_Undefined();
+    has_caught_ = false;
+    stack_frame_ = JS_GetCurrentStackFrame(isolate->runtime_);
     prev_ = isolate_->currentTryCatch_;
     isolate_->currentTryCatch_ = this;
 }
@@ -1186,7 +2886,7 @@ TryCatch::~TryCatch() {
 }
     
 bool TryCatch::HasCaught() const {
-    return !JS_IsUndefined(catched_) && !JS_IsNull(catched_);
+    return has_caught_;
 }
     
 Local<Value> TryCatch::Exception() const {
@@ -1194,43 +2894,30 @@ Local<Value> TryCatch::Exception() const {
 }
 
 MaybeLocal<Value> TryCatch::StackTrace(Local<Context> context) const {
-    auto str = context->GetIsolate()->Alloc<String>();
-    str->value_ = JS_GetProperty(isolate_->current_context_->context_, catched_, JS_ATOM_stack);;
-    return MaybeLocal<Value>(Local<String>(str));
+    return StackTrace(context, Exception());
 }
 
+//和V8一样，只有对象才有stack，throw 1、throw undefined等返回空
 MaybeLocal<Value> TryCatch::StackTrace(
         Local<Context> context, Local<Value> exception) {
-    auto isolate_ = context->GetIsolate();
-    auto str = isolate_->Alloc<String>();
-    str->value_ = JS_GetProperty(isolate_->current_context_->context_, exception->value_, JS_ATOM_stack);
-    return MaybeLocal<Value>(Local<String>(str));
+    if (!JS_IsObject(exception->value_)) {
+        return MaybeLocal<Value>();
+    }
+    return ProcessResult(context->GetIsolate(), JS_GetProperty(context->context_, exception->value_, JS_ATOM_stack));
 }
     
 Local<v8::Message> TryCatch::Message() const {
-    JSValue fileNameVal = JS_GetProperty(isolate_->current_context_->context_, catched_, JS_ATOM_fileName);
-    JSValue lineNumVal = JS_GetProperty(isolate_->current_context_->context_, catched_, JS_ATOM_lineNumber);
-    
-    Local<v8::Message> message(new v8::Message());
-    
-    if (JS_IsUndefined(fileNameVal)) {
-        message->resource_name_ = "<unknow>";
-        message->line_number_ = - 1;
-    } else {
-        const char* fileName = JS_ToCString(isolate_->current_context_->context_, fileNameVal);
-        message->resource_name_ = fileName;
-        JS_FreeCString(isolate_->current_context_->context_, fileName);
-        JS_ToInt32(isolate_->current_context_->context_, &message->line_number_, lineNumVal);
+    if (message_.IsEmpty() && HasCaught()) {
+        message_ = Local<v8::Message>(new v8::Message(isolate_, catched_));
     }
-    
-    JS_FreeValue(isolate_->current_context_->context_, lineNumVal);
-    JS_FreeValue(isolate_->current_context_->context_, fileNameVal);
-    
-    return message;
+    return message_;
 }
 
 void TryCatch::handleException() {
+    JS_FreeValue(isolate_->current_context_->context_, catched_);
     catched_ = JS_GetException(isolate_->current_context_->context_);
+    has_caught_ = true;
+    message_ = Local<v8::Message>();
 }
 
 }  // namespace v8
@@ -0,0 +1,276 @@
+// ArrayBuffer / BackingStore的内存所有权测试
+
+#include <map>
+
+#include "v8-test.h"
+
+//记录每块内存分配时的大小，Free传入的大小对不上就计数
+class SizeCheckingAllocator : public v8::ArrayBuffer::Allocator {
+public:
+    void* Allocate(size_t length) override {
+        return Record(calloc(length, 1), length);
+    }
+
+    void* AllocateUninitialized(size_t length) override {
+        return Record(malloc(length), length);
+    }
+
+    void Free(void* data, size_t length) override {
+        auto iter = sizes_.find(data);
+        if (iter == sizes_.end() || iter->second != length) {
+            ++mismatches_;
+        } else {
+            sizes_.erase(iter);
+        }
+        free(data);
+    }
+
+    std::map<void*, size_t> sizes_;
+
+    int mismatches_ = 0;
+
+private:
+    void* Record(void* data, size_t length) {
+        if (data) {
+            sizes_[data] = length;
+        }
+        return data;
+    }
+};
+
+//每次分配都失败，记录Free被调用的次数
+class FailingAllocator : public v8::ArrayBuffer::Allocator {
+public:
+    void* Allocate(size_t length) override {
+        return nullptr;
+    }
+
+    void* AllocateUninitialized(size_t length) override {
+        return nullptr;
+    }
+
+    void Free(void* data, size_t length) override {
+        ++frees_;
+    }
+
+    int frees_ = 0;
+};
+
+//0字节的buffer实际分配了1字节，Free时传的大小要和分配时一致
+static void TestZeroLengthFreeSize() {
+    SizeCheckingAllocator* allocator = new SizeCheckingAllocator();
+    TestIsolate isolate(allocator);
+    {
+        v8::Isolate::Scope isolate_scope(isolate);
+        v8::HandleScope handle_scope(isolate);
+        v8::Local<v8::Context> context = v8::Context::New(isolate);
+        v8::Context::Scope context_scope(context);
+
+        std::unique_ptr<v8::BackingStore> store = v8::ArrayBuffer::NewBackingStore(isolate, 0);
+        TEST_CHECK(store->Data() != nullptr);
+        TEST_CHECK_EQ(store->ByteLength(), (size_t)0);
+        store.reset();
+
+        std::shared_ptr<v8::BackingStore> shared;
+        {
+            v8::HandleScope scope(isolate);
+            shared = v8::ArrayBuffer::New(isolate, 0)->GetBackingStore();
+        }
+        isolate->LowMemoryNotification();
+        shared.reset();
+    }
+    isolate.Dispose();
+    TEST_CHECK_EQ(allocator->mismatches_, 0);
+    TEST_CHECK(allocator->sizes_.empty());
+}
+
+//BackingStore可以比Isolate活得更久（Allocator则要比BackingStore活得更久），allocator为空时buffer的内存来自JS堆
+static void CheckBackingStoreOutlivesIsolate(v8::ArrayBuffer::Allocator* allocator) {
+    std::shared_ptr<v8::BackingStore> store;
+    v8::Isolate::CreateParams params;
+    params.array_buffer_allocator = allocator;
+    v8::Isolate* isolate = v8::Isolate::New(params);
+    {
+        v8::Isolate::Scope isolate_scope(isolate);
+        v8::HandleScope handle_scope(isolate);
+        v8::Local<v8::Context> context = v8::Context::New(isolate);
+        v8::Context::Scope context_scope(context);
+
+        v8::Local<v8::Value> result;
+        TEST_CHECK(TestRun(context, "var u8 = new Uint8Array(16); u8[0] = 1; u8.buffer").ToLocal(&result));
+        store = result.As<v8::ArrayBuffer>()->GetBackingStore();
+        TEST_CHECK_EQ(store->ByteLength(), (size_t)16);
+        //BackingStore和已有的view看到的是同一块内存
+        static_cast<uint8_t*>(store->Data())[1] = 2;
+        TEST_CHECK(TestRun(context, "u8[0] = 3; u8[1]").ToLocal(&result));
+        if (!result.IsEmpty()) {
+            TEST_CHECK_EQ(result->Int32Value(context).ToChecked(), 2);
+        }
+        TEST_CHECK_EQ(static_cast<uint8_t*>(store->Data())[0], 3);
+    }
+    isolate->Dispose();
+    TEST_CHECK_EQ(static_cast<uint8_t*>(store->Data())[0], 3);
+    store.reset();
+}
+
+static void TestBackingStoreOutlivesIsolate() {
+    std::unique_ptr<v8::ArrayBuffer::Allocator> allocator(v8::ArrayBuffer::Allocator::NewDefaultAllocator());
+    CheckBackingStoreOutlivesIsolate(allocator.get());
+    CheckBackingStoreOutlivesIsolate(nullptr);
+}
+
+//ARRAY_BUFFER类型的统计，在index为0时刷新的同一个快照里
+static bool FindArrayBufferStatistics(v8::Isolate* isolate, size_t* count, size_t* size) {
+    for (size_t i = 0; i < isolate->NumberOfTrackedHeapObjectTypes(); i++) {
+        v8::HeapObjectStatistics stats;
+        TEST_CHECK(isolate->GetHeapObjectStatisticsAtLastGC(&stats, i));
+        if (strcmp(stats.object_type(), "ARRAY_BUFFER") == 0) {
+            *count = stats.object_count();
+            *size = stats.object_size();
+            return true;
+        }
+    }
+    return false;
+}
+
+static void TestArrayBufferHeapStatistics() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+    v8::Context::Scope context_scope(context);
+
+    size_t count_before = 0, size_before = 0;
+    TEST_CHECK(FindArrayBufferStatistics(isolate, &count_before, &size_before));
+    v8::Local<v8::ArrayBuffer> buffer = v8::ArrayBuffer::New(isolate, 1000);
+    size_t count = 0, size = 0;
+    TEST_CHECK(FindArrayBufferStatistics(isolate, &count, &size));
+    TEST_CHECK_EQ(count, count_before + 1);
+    TEST_CHECK_EQ(size, size_before + 1000);
+    TEST_CHECK(!buffer.IsEmpty());
+}
+
+//超出长度限制时返回空Local，异常交给TryCatch，不会残留到isolate上
+static void TestNewTooLarge() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+    v8::Context::Scope context_scope(context);
+
+    v8::TryCatch try_catch(isolate);
+    v8::Local<v8::ArrayBuffer> buffer = v8::ArrayBuffer::New(isolate, (size_t)3 << 30);
+    TEST_CHECK(buffer.IsEmpty());
+    TEST_CHECK(try_catch.HasCaught());
+    TEST_CHECK(!isolate->HasPendingException());
+}
+
+//建buffer对象失败时返回空，BackingStore的引用要还回来
+static void TestNewFromBackingStoreOutOfMemory() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+    v8::Context::Scope context_scope(context);
+
+    std::shared_ptr<v8::BackingStore> store = v8::ArrayBuffer::NewBackingStore(isolate, 16);
+    std::shared_ptr<v8::BackingStore> shared_store = v8::SharedArrayBuffer::NewBackingStore(isolate, 16);
+    JSMallocState malloc_state;
+    JS_GetMallocState(isolate->runtime_, &malloc_state);
+    JS_SetMemoryLimit(isolate->runtime_, malloc_state.malloc_size);
+    {
+        v8::TryCatch try_catch(isolate);
+        TEST_CHECK(v8::ArrayBuffer::New(isolate, store).IsEmpty());
+        TEST_CHECK(try_catch.HasCaught());
+    }
+    {
+        v8::TryCatch try_catch(isolate);
+        TEST_CHECK(v8::SharedArrayBuffer::New(isolate, shared_store).IsEmpty());
+        TEST_CHECK(try_catch.HasCaught());
+    }
+    JS_SetMemoryLimit(isolate->runtime_, (size_t)-1);
+    TEST_CHECK_EQ(store.use_count(), 1);
+    TEST_CHECK_EQ(shared_store.use_count(), 1);
+    TEST_CHECK(!isolate->HasPendingException());
+
+    //内存恢复后同一个BackingStore还能正常使用
+    TEST_CHECK(!v8::ArrayBuffer::New(isolate, store).IsEmpty());
+    TEST_CHECK(!v8::SharedArrayBuffer::New(isolate, shared_store).IsEmpty());
+}
+
+//越界的TypedArray返回空，RangeError交给TryCatch
+static void TestTypedArrayOutOfRange() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+    v8::Context::Scope context_scope(context);
+
+    v8::Local<v8::ArrayBuffer> buffer = v8::ArrayBuffer::New(isolate, 16);
+    {
+        v8::TryCatch try_catch(isolate);
+        TEST_CHECK(v8::Uint8Array::New(buffer, 100, 10).IsEmpty());
+        TEST_CHECK(try_catch.HasCaught());
+    }
+    {
+        v8::TryCatch try_catch(isolate);
+        TEST_CHECK(v8::Uint8Array::New(buffer, 8, 10).IsEmpty());
+        TEST_CHECK(try_catch.HasCaught());
+    }
+    TEST_CHECK(!isolate->HasPendingException());
+
+    v8::Local<v8::Uint8Array> view = v8::Uint8Array::New(buffer, 8, 8);
+    TEST_CHECK(!view.IsEmpty());
+    TEST_CHECK_EQ(view->Length(), 8u);
+}
+
+//NewBackingStore分配失败时得到的是没有内存的BackingStore，SharedArrayBuffer::New要拒绝它
+static void TestSharedArrayBufferWithoutData() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+    v8::Context::Scope context_scope(context);
+
+    std::shared_ptr<v8::BackingStore> store = v8::SharedArrayBuffer::NewBackingStore(
+        nullptr, 0, v8::BackingStore::EmptyDeleter, nullptr);
+    v8::TryCatch try_catch(isolate);
+    TEST_CHECK(v8::SharedArrayBuffer::New(isolate, store).IsEmpty());
+    TEST_CHECK(try_catch.HasCaught());
+    TEST_CHECK_EQ(store.use_count(), 1);
+    TEST_CHECK(!isolate->HasPendingException());
+}
+
+//Allocator分配失败时得到长度为0的BackingStore，建出来的buffer也是空的
+static void TestNewBackingStoreAllocationFailure() {
+    FailingAllocator* allocator = new FailingAllocator;
+    TestIsolate isolate(allocator);
+    {
+        v8::Isolate::Scope isolate_scope(isolate);
+        v8::HandleScope handle_scope(isolate);
+        v8::Local<v8::Context> context = v8::Context::New(isolate);
+        v8::Context::Scope context_scope(context);
+
+        std::shared_ptr<v8::BackingStore> store = v8::ArrayBuffer::NewBackingStore(isolate, 64);
+        TEST_CHECK(store->Data() == nullptr);
+        TEST_CHECK_EQ(store->ByteLength(), 0u);
+        v8::Local<v8::ArrayBuffer> buffer = v8::ArrayBuffer::New(isolate, store);
+        TEST_CHECK(!buffer.IsEmpty());
+        TEST_CHECK_EQ(buffer->GetBackingStore()->ByteLength(), 0u);
+    }
+    isolate.Dispose();
+    TEST_CHECK_EQ(allocator->frees_, 0);
+}
+
+int main() {
+    TestPlatform platform;
+    RUN_TEST(TestZeroLengthFreeSize);
+    RUN_TEST(TestBackingStoreOutlivesIsolate);
+    RUN_TEST(TestArrayBufferHeapStatistics);
+    RUN_TEST(TestNewTooLarge);
+    RUN_TEST(TestNewFromBackingStoreOutOfMemory);
+    RUN_TEST(TestTypedArrayOutOfRange);
+    RUN_TEST(TestSharedArrayBufferWithoutData);
+    RUN_TEST(TestNewBackingStoreAllocationFailure);
+    return g_test_failures;
+}
@@ -0,0 +1,175 @@
+// 异常在c++回调和js之间传递的行为测试
+
+#include "v8-test.h"
+
+//throwValue(v)：c++里ThrowException(v)
+static void ThrowValue(const v8::FunctionCallbackInfo<v8::Value>& info) {
+    info.GetIsolate()->ThrowException(info[0]);
+}
+
+//callArg(f)：c++里调用f，返回Call是否失败，异常应该继续抛给外层js
+static void CallArg(const v8::FunctionCallbackInfo<v8::Value>& info) {
+    v8::Isolate* isolate = info.GetIsolate();
+    v8::Local<v8::Context> context = isolate->GetCurrentContext();
+    v8::Local<v8::Function> func = info[0].As<v8::Function>();
+    v8::MaybeLocal<v8::Value> result = func->Call(context, context->Global(), 0, nullptr);
+    info.GetReturnValue().Set(v8::Boolean::New(isolate, result.IsEmpty()));
+}
+
+static void Noop(const v8::FunctionCallbackInfo<v8::Value>& info) {
+}
+
+//getProp(o)：c++里读o.x，失败时异常应该抛给外层js
+static void GetProp(const v8::FunctionCallbackInfo<v8::Value>& info) {
+    v8::Isolate* isolate = info.GetIsolate();
+    v8::Local<v8::Context> context = isolate->GetCurrentContext();
+    v8::Local<v8::Value> value;
+    if (info[0].As<v8::Object>()->Get(context, TestString(isolate, "x")).ToLocal(&value)) {
+        info.GetReturnValue().Set(value);
+    }
+}
+
+//把script的结果（字符串）和期望值比较
+static void ExpectScript(v8::Local<v8::Context> context, const char* source, const char* expected) {
+    v8::Isolate* isolate = context->GetIsolate();
+    v8::TryCatch try_catch(isolate);
+    v8::Local<v8::Value> result;
+    TEST_CHECK(TestRun(context, source).ToLocal(&result));
+    TEST_CHECK(!try_catch.HasCaught());
+    if (!result.IsEmpty()) {
+        std::string actual = TestToString(isolate, result);
+        if (actual != expected) {
+            fprintf(stderr, "  %s\n  => %s, expected %s\n", source, actual.c_str(), expected);
+        }
+        TEST_CHECK_EQ(actual, expected);
+    }
+}
+
+static void TestThrowFromCallback() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+    v8::Context::Scope context_scope(context);
+    TestSetFunction(context, "throwValue", ThrowValue);
+
+    ExpectScript(context, "try { throwValue(1); 'not thrown' } catch (e) { 'caught ' + e }", "caught 1");
+    ExpectScript(context, "try { throwValue(null); 'not thrown' } catch (e) { 'caught ' + e }", "caught null");
+    ExpectScript(context, "try { throwValue(undefined); 'not thrown' } catch (e) { 'caught ' + e }", "caught undefined");
+}
+
+//回调里调用的js函数抛出的异常，回调返回后继续往外抛
+static void TestRethrowThroughCallback() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+    v8::Context::Scope context_scope(context);
+    TestSetFunction(context, "callArg", CallArg);
+
+    ExpectScript(context, "try { callArg(function() { throw 1; }); 'not thrown' } catch (e) { 'caught ' + e }", "caught 1");
+    ExpectScript(context, "try { callArg(function() { throw null; }); 'not thrown' } catch (e) { 'caught ' + e }", "caught null");
+    ExpectScript(context, "try { callArg(function() { throw undefined; }); 'not thrown' } catch (e) { 'caught ' + e }", "caught undefined");
+    ExpectScript(context, "'' + callArg(function() { return 1; })", "false");
+}
+
+static void TestTryCatchNullAndUndefined() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+    v8::Context::Scope context_scope(context);
+
+    {
+        v8::TryCatch try_catch(isolate);
+        TEST_CHECK(TestRun(context, "throw null").IsEmpty());
+        TEST_CHECK(try_catch.HasCaught());
+        TEST_CHECK(try_catch.Exception()->IsNull());
+    }
+    {
+        v8::TryCatch try_catch(isolate);
+        TEST_CHECK(TestRun(context, "throw undefined").IsEmpty());
+        TEST_CHECK(try_catch.HasCaught());
+        TEST_CHECK(try_catch.Exception()->IsUndefined());
+    }
+    {
+        v8::TryCatch try_catch(isolate);
+        TEST_CHECK(!TestRun(context, "try { throw null } catch (e) {} 1").IsEmpty());
+        TEST_CHECK(!try_catch.HasCaught());
+        TEST_CHECK(!isolate->HasPendingException());
+    }
+}
+
+//异常被内层TryCatch捕获后，外层看不到
+static void TestNestedTryCatch() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+    v8::Context::Scope context_scope(context);
+
+    v8::TryCatch outer(isolate);
+    {
+        v8::TryCatch inner(isolate);
+        TEST_CHECK(TestRun(context, "throw new Error('inner')").IsEmpty());
+        TEST_CHECK(inner.HasCaught());
+    }
+    TEST_CHECK(!outer.HasCaught());
+    TEST_CHECK(!isolate->HasPendingException());
+}
+
+//没有TryCatch时失败的接口调用不能把异常留在quickjs上，否则下一次回调会把它抛出来
+static void TestFailedCallDoesNotPoison() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+    v8::Context::Scope context_scope(context);
+    TestSetFunction(context, "noop", Noop);
+
+    v8::Local<v8::Object> throwing = TestRun(context,
+        "({ get x() { throw new Error('get') }, set x(v) { throw new Error('set') }, toString() { throw new Error('toString') } })")
+        .ToLocalChecked().As<v8::Object>();
+    v8::Local<v8::String> x = TestString(isolate, "x");
+    TEST_CHECK(v8::Uint8Array::New(v8::ArrayBuffer::New(isolate, 16), 100, 10).IsEmpty());
+    TEST_CHECK(v8::ArrayBuffer::New(isolate, (size_t)3 << 30).IsEmpty());
+    TEST_CHECK(throwing->Get(context, x).IsEmpty());
+    TEST_CHECK(throwing->Set(context, x, x).IsNothing());
+    TEST_CHECK(throwing->ToString(context).IsEmpty());
+    TEST_CHECK(*v8::String::Utf8Value(isolate, throwing) == nullptr);
+    TEST_CHECK(!isolate->HasPendingException());
+    ExpectScript(context, "noop(); 'ok'", "ok");
+
+    //有TryCatch时由它捕获
+    {
+        v8::TryCatch try_catch(isolate);
+        TEST_CHECK(throwing->Get(context, x).IsEmpty());
+        TEST_CHECK(try_catch.HasCaught());
+        TEST_CHECK_EQ(TestToString(isolate, try_catch.Exception()), "Error: get");
+    }
+    TEST_CHECK(!isolate->HasPendingException());
+}
+
+//回调里失败的接口调用，异常在回调返回后抛给js
+static void TestFailedCallInCallback() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+    v8::Context::Scope context_scope(context);
+    TestSetFunction(context, "getProp", GetProp);
+
+    ExpectScript(context, "try { getProp({ get x() { throw 1 } }); 'not thrown' } catch (e) { 'caught ' + e }", "caught 1");
+    ExpectScript(context, "'' + getProp({ x: 2 })", "2");
+}
+
+int main() {
+    TestPlatform platform;
+    RUN_TEST(TestThrowFromCallback);
+    RUN_TEST(TestRethrowThroughCallback);
+    RUN_TEST(TestTryCatchNullAndUndefined);
+    RUN_TEST(TestNestedTryCatch);
+    RUN_TEST(TestFailedCallDoesNotPoison);
+    RUN_TEST(TestFailedCallInCallback);
+    return g_test_failures;
+}
@@ -0,0 +1,102 @@
+// HandleScope / 分块handle分配的行为测试
+
+#include <thread>
+
+#include "v8-test.h"
+
+//跨越多个handle块后，之前的handle地址和值都不能变
+static void TestHandlesStableAcrossBlocks() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+    v8::Context::Scope context_scope(context);
+
+    const int kCount = 2000;
+    std::vector<v8::Local<v8::Integer>> handles;
+    std::vector<v8::Integer*> addresses;
+    for (int i = 0; i < kCount; i++) {
+        v8::Local<v8::Integer> v = v8::Integer::New(isolate, i);
+        handles.push_back(v);
+        addresses.push_back(*v);
+    }
+    for (int i = 0; i < kCount; i++) {
+        TEST_CHECK_EQ(*handles[i], addresses[i]);
+        TEST_CHECK_EQ(handles[i]->Value(), i);
+    }
+}
+
+//内层scope退出后再分配，外层handle不受影响
+static void TestNestedScopes() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+    v8::Context::Scope context_scope(context);
+
+    v8::Local<v8::String> outer = TestString(isolate, "outer");
+    for (int round = 0; round < 10; round++) {
+        v8::HandleScope inner(isolate);
+        for (int i = 0; i < 1000; i++) {
+            v8::Local<v8::Value> tmp = TestString(isolate, "inner");
+            (void)tmp;
+        }
+    }
+    v8::Local<v8::String> after = TestString(isolate, "after");
+    TEST_CHECK_EQ(TestToString(isolate, outer), "outer");
+    TEST_CHECK_EQ(TestToString(isolate, after), "after");
+}
+
+static v8::Local<v8::Object> MakeObject(v8::Isolate* isolate, v8::Local<v8::Context> context) {
+    v8::EscapableHandleScope scope(isolate);
+    v8::Local<v8::Object> obj = v8::Object::New(isolate);
+    //让返回的handle位于一个已经释放的块之后
+    for (int i = 0; i < 600; i++) {
+        v8::Local<v8::Value> tmp = v8::Integer::New(isolate, i);
+        (void)tmp;
+    }
+    obj->Set(context, TestString(isolate, "x"), v8::Integer::New(isolate, 42)).Check();
+    return scope.Escape(obj);
+}
+
+static void TestEscape() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+    v8::Context::Scope context_scope(context);
+
+    v8::Local<v8::Object> obj = MakeObject(isolate, context);
+    v8::Local<v8::Value> x = obj->Get(context, TestString(isolate, "x")).ToLocalChecked();
+    TEST_CHECK_EQ(x->Int32Value(context).ToChecked(), 42);
+}
+
+//当前isolate是每个线程各自的
+static void TestCurrentIsolatePerThread() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    TEST_CHECK_EQ(v8::Isolate::GetCurrent(), (v8::Isolate*)isolate);
+
+    bool thread_ok = false;
+    std::thread thread([&thread_ok]() {
+        bool ok = v8::Isolate::GetCurrent() == nullptr;
+        TestIsolate other;
+        {
+            v8::Isolate::Scope other_scope(other);
+            ok = ok && v8::Isolate::GetCurrent() == (v8::Isolate*)other;
+        }
+        thread_ok = ok && v8::Isolate::GetCurrent() == nullptr;
+    });
+    thread.join();
+    TEST_CHECK(thread_ok);
+    TEST_CHECK_EQ(v8::Isolate::GetCurrent(), (v8::Isolate*)isolate);
+}
+
+int main() {
+    TestPlatform platform;
+    RUN_TEST(TestHandlesStableAcrossBlocks);
+    RUN_TEST(TestNestedScopes);
+    RUN_TEST(TestEscape);
+    RUN_TEST(TestCurrentIsolatePerThread);
+    return g_test_failures;
+}
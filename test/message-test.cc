@@ -0,0 +1,121 @@
+// Message / StackTrace的位置信息和生命周期测试
+
+#include "v8-test.h"
+
+static v8::MaybeLocal<v8::Value> RunWithOrigin(v8::Local<v8::Context> context, const char* name, const char* source) {
+    v8::Isolate* isolate = context->GetIsolate();
+    v8::ScriptOrigin origin(TestString(isolate, name));
+    v8::Local<v8::Script> script;
+    if (!v8::Script::Compile(context, TestString(isolate, source), &origin).ToLocal(&script)) {
+        return v8::MaybeLocal<v8::Value>();
+    }
+    return script->Run(context);
+}
+
+static const char kThrowSource[] =
+    "function f() {\n"
+    "    throw new Error('boom');\n"
+    "}\n";
+
+//js读过e.stack再抛出，Message仍然能给出抛出的位置
+static void TestLocationAfterStackRead() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+    v8::Context::Scope context_scope(context);
+
+    TEST_CHECK(!RunWithOrigin(context, "throw.js", kThrowSource).IsEmpty());
+    const char* sources[] = {
+        "f()",
+        "try { f() } catch (e) { e.stack; throw e }",
+        "try { f() } catch (e) { e.stack = 'replaced'; throw e }",
+    };
+    for (const char* source : sources) {
+        v8::TryCatch try_catch(isolate);
+        TEST_CHECK(RunWithOrigin(context, "caller.js", source).IsEmpty());
+        TEST_CHECK(try_catch.HasCaught());
+        v8::Local<v8::Message> message = try_catch.Message();
+        TEST_CHECK_EQ(TestToString(isolate, message->GetScriptResourceName()), "throw.js");
+        TEST_CHECK_EQ(message->GetLineNumber(context).FromMaybe(-1), 2);
+        TEST_CHECK(!message->GetStackTrace().IsEmpty());
+    }
+}
+
+//Message、StackTrace、StackFrame被Local持有到Isolate销毁之后
+static void TestMessageOutlivesIsolate() {
+    TestIsolate isolate;
+    v8::Local<v8::Message> message;
+    v8::Local<v8::StackTrace> stack_trace;
+    v8::Local<v8::StackFrame> frame;
+    {
+        v8::Isolate::Scope isolate_scope(isolate);
+        v8::HandleScope handle_scope(isolate);
+        v8::Local<v8::Context> context = v8::Context::New(isolate);
+        v8::Context::Scope context_scope(context);
+
+        TEST_CHECK(!RunWithOrigin(context, "throw.js", kThrowSource).IsEmpty());
+        v8::TryCatch try_catch(isolate);
+        TEST_CHECK(RunWithOrigin(context, "caller.js", "f()").IsEmpty());
+        message = try_catch.Message();
+        TEST_CHECK_EQ(message->GetLineNumber(context).FromMaybe(-1), 2);
+        stack_trace = message->GetStackTrace();
+        TEST_CHECK(!stack_trace.IsEmpty());
+        if (!stack_trace.IsEmpty()) {
+            frame = stack_trace->GetFrame(isolate, 0);
+        }
+    }
+    isolate.Dispose();
+    TEST_CHECK_EQ(message->GetLineNumber(v8::Local<v8::Context>()).FromMaybe(-1), 2);
+    TEST_CHECK(message->GetScriptResourceName().IsEmpty());
+    TEST_CHECK(message->GetStackTrace().IsEmpty());
+    TEST_CHECK_EQ(stack_trace->GetFrameCount(), 0);
+    TEST_CHECK(stack_trace->GetFrame(nullptr, 0).IsEmpty());
+    TEST_CHECK(!frame.IsEmpty());
+    if (!frame.IsEmpty()) {
+        TEST_CHECK_EQ(frame->GetLineNumber(), -1);
+        TEST_CHECK(frame->GetScriptName().IsEmpty());
+        TEST_CHECK(frame->GetFunctionName().IsEmpty());
+    }
+}
+
+//离开Context::Scope后读位置信息，只用runtime
+static void TestReadOutsideContextScope() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+    v8::Local<v8::Message> message;
+    {
+        v8::Context::Scope context_scope(context);
+        TEST_CHECK(!RunWithOrigin(context, "throw.js", kThrowSource).IsEmpty());
+        v8::TryCatch try_catch(isolate);
+        TEST_CHECK(RunWithOrigin(context, "caller.js", "f()").IsEmpty());
+        message = try_catch.Message();
+    }
+    TEST_CHECK(!message.IsEmpty());
+    TEST_CHECK_EQ(message->GetLineNumber(context).FromMaybe(-1), 2);
+    v8::Local<v8::Value> name = message->GetScriptResourceName();
+    TEST_CHECK(!name.IsEmpty());
+    v8::Local<v8::StackTrace> stack_trace = message->GetStackTrace();
+    TEST_CHECK(!stack_trace.IsEmpty());
+    TEST_CHECK(stack_trace->GetFrameCount() > 0);
+    v8::Local<v8::StackFrame> frame = stack_trace->GetFrame(isolate, 0);
+    TEST_CHECK_EQ(frame->GetLineNumber(), 2);
+    TEST_CHECK(!frame->GetScriptName().IsEmpty());
+    TEST_CHECK(!frame->GetFunctionName().IsEmpty());
+    TEST_CHECK(v8::StackTrace::CurrentStackTrace(isolate, 10).IsEmpty());
+
+    v8::Context::Scope context_scope(context);
+    TEST_CHECK_EQ(TestToString(isolate, name), "throw.js");
+    TEST_CHECK_EQ(TestToString(isolate, frame->GetScriptName()), "throw.js");
+    TEST_CHECK_EQ(TestToString(isolate, frame->GetFunctionName()), "f");
+}
+
+int main() {
+    TestPlatform platform;
+    RUN_TEST(TestLocationAfterStackRead);
+    RUN_TEST(TestMessageOutlivesIsolate);
+    RUN_TEST(TestReadOutsideContextScope);
+    return g_test_failures;
+}
@@ -0,0 +1,88 @@
+// Module的行为测试
+
+#include "v8-test.h"
+
+static v8::MaybeLocal<v8::Module> CompileModule(v8::Isolate* isolate, const char* name, const char* source) {
+    v8::ScriptOrigin origin(TestString(isolate, name));
+    v8::ScriptCompiler::Source src(TestString(isolate, source), origin);
+    return v8::ScriptCompiler::CompileModule(isolate, &src);
+}
+
+static v8::MaybeLocal<v8::Module> ResolveNothing(v8::Local<v8::Context> context, v8::Local<v8::String> specifier, v8::Local<v8::Module> referrer) {
+    return v8::MaybeLocal<v8::Module>();
+}
+
+static void TestEvaluate() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+    v8::Context::Scope context_scope(context);
+
+    v8::Local<v8::Module> module = CompileModule(isolate, "m", "export const x = 6 * 7;").ToLocalChecked();
+    TEST_CHECK_EQ(module->GetStatus(), v8::Module::kUninstantiated);
+    TEST_CHECK(module->InstantiateModule(context, ResolveNothing).FromMaybe(false));
+    TEST_CHECK(!module->Evaluate(context).IsEmpty());
+    TEST_CHECK_EQ(module->GetStatus(), v8::Module::kEvaluated);
+    v8::Local<v8::Object> ns = module->GetModuleNamespace().As<v8::Object>();
+    TEST_CHECK_EQ(ns->Get(context, TestString(isolate, "x")).ToLocalChecked()->Int32Value(context).ToChecked(), 42);
+}
+
+//import的模块名，下标越界时返回空
+static void TestModuleRequests() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+    v8::Context::Scope context_scope(context);
+
+    v8::Local<v8::Module> module = CompileModule(isolate, "m", "import { y } from 'dep'; export const x = y;").ToLocalChecked();
+    TEST_CHECK_EQ(module->GetModuleRequestsLength(), 1);
+    v8::Local<v8::String> request = module->GetModuleRequest(0);
+    TEST_CHECK(!request.IsEmpty());
+    if (!request.IsEmpty()) {
+        TEST_CHECK_EQ(TestToString(isolate, request), "dep");
+    }
+    TEST_CHECK(module->GetModuleRequest(1).IsEmpty());
+    TEST_CHECK(module->GetModuleRequest(-1).IsEmpty());
+}
+
+//所在的Context析构后，Module的操作都失败，而不是访问已经释放的模块
+static void TestModuleOutlivesContext() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+
+    v8::Local<v8::Module> module;
+    {
+        v8::HandleScope scope(isolate);
+        v8::Local<v8::Context> compile_context = v8::Context::New(isolate);
+        v8::Context::Scope context_scope(compile_context);
+        module = CompileModule(isolate, "m", "import { y } from 'dep'; export const x = y;").ToLocalChecked();
+    }
+
+    v8::Context::Scope context_scope(context);
+    TEST_CHECK_EQ(module->GetStatus(), v8::Module::kErrored);
+    {
+        v8::TryCatch try_catch(isolate);
+        TEST_CHECK(module->InstantiateModule(context, ResolveNothing).IsNothing());
+        TEST_CHECK(try_catch.HasCaught());
+    }
+    {
+        v8::TryCatch try_catch(isolate);
+        TEST_CHECK(module->Evaluate(context).IsEmpty());
+        TEST_CHECK(try_catch.HasCaught());
+    }
+    TEST_CHECK(module->GetModuleNamespace()->IsUndefined());
+    TEST_CHECK_EQ(module->GetModuleRequestsLength(), 0);
+    TEST_CHECK(module->GetModuleRequest(0).IsEmpty());
+}
+
+int main() {
+    TestPlatform platform;
+    RUN_TEST(TestEvaluate);
+    RUN_TEST(TestModuleRequests);
+    RUN_TEST(TestModuleOutlivesContext);
+    return g_test_failures;
+}
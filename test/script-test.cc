@@ -0,0 +1,61 @@
+// Script / UnboundScript在多个Context之间的行为测试
+
+#include "v8-test.h"
+
+//在别的Context里Run，访问的是运行时Context的全局对象
+static void TestRunInOtherContext() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context_a = v8::Context::New(isolate);
+    v8::Local<v8::Context> context_b = v8::Context::New(isolate);
+
+    v8::Local<v8::Script> script;
+    {
+        v8::Context::Scope context_scope(context_a);
+        script = v8::Script::Compile(context_a, TestString(isolate, "var counter = (typeof counter == 'number' ? counter : 0) + 1; counter")).ToLocalChecked();
+        TEST_CHECK_EQ(script->Run(context_a).ToLocalChecked()->Int32Value(context_a).ToChecked(), 1);
+    }
+    {
+        v8::Context::Scope context_scope(context_b);
+        TEST_CHECK_EQ(script->Run(context_b).ToLocalChecked()->Int32Value(context_b).ToChecked(), 1);
+        TEST_CHECK_EQ(script->Run(context_b).ToLocalChecked()->Int32Value(context_b).ToChecked(), 2);
+    }
+    {
+        v8::Context::Scope context_scope(context_a);
+        TEST_CHECK_EQ(script->Run(context_a).ToLocalChecked()->Int32Value(context_a).ToChecked(), 2);
+    }
+}
+
+//编译时的Context析构后，Script仍然可以在别的Context里Run
+static void TestScriptOutlivesContext() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+
+    v8::Local<v8::Script> script;
+    {
+        v8::HandleScope scope(isolate);
+        v8::Local<v8::Context> compile_context = v8::Context::New(isolate);
+        v8::Context::Scope context_scope(compile_context);
+        script = v8::Script::Compile(compile_context, TestString(isolate, "(function(a) { return a * 2; })(21)")).ToLocalChecked();
+    }
+    v8::Context::Scope context_scope(context);
+    isolate->LowMemoryNotification();
+    v8::Local<v8::Value> result;
+    TEST_CHECK(script->Run(context).ToLocal(&result));
+    if (!result.IsEmpty()) {
+        TEST_CHECK_EQ(result->Int32Value(context).ToChecked(), 42);
+    }
+    //已经脱离Context的Script也能生成code cache
+    std::unique_ptr<v8::ScriptCompiler::CachedData> cache(v8::ScriptCompiler::CreateCodeCache(script->GetUnboundScript()));
+    TEST_CHECK(cache != nullptr);
+}
+
+int main() {
+    TestPlatform platform;
+    RUN_TEST(TestRunInOtherContext);
+    RUN_TEST(TestScriptOutlivesContext);
+    return g_test_failures;
+}
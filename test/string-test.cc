@@ -0,0 +1,119 @@
+// String的构造和WriteUtf8等写入接口的边界测试
+
+#include "v8-test.h"
+
+static const char kGuard = '#';
+
+//写入的字节数不超过capacity，不截断字符，buffer之后的内容不被改动
+static void CheckWriteUtf8(v8::Isolate* isolate, v8::Local<v8::String> str, int capacity,
+                           const char* expected, int expected_written, int expected_nchars,
+                           int options = v8::String::NO_OPTIONS) {
+    char buffer[64];
+    memset(buffer, kGuard, sizeof(buffer));
+    int nchars = -1;
+    int written = str->WriteUtf8(isolate, buffer, capacity, &nchars, options);
+    TEST_CHECK_EQ(written, expected_written);
+    TEST_CHECK_EQ(std::string(buffer, written), std::string(expected, expected_written));
+    TEST_CHECK_EQ(nchars, expected_nchars);
+    if (capacity >= 0) {
+        TEST_CHECK(written <= capacity);
+    }
+    TEST_CHECK_EQ(buffer[written], kGuard);
+}
+
+static void TestWriteUtf8Bounds() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+    v8::Context::Scope context_scope(context);
+
+    v8::Local<v8::String> ascii = TestString(isolate, "hello");
+    CheckWriteUtf8(isolate, ascii, -1, "hello", 6, 5);
+    CheckWriteUtf8(isolate, ascii, 6, "hello", 6, 5);
+    //放不下'\0'时不补
+    CheckWriteUtf8(isolate, ascii, 5, "hello", 5, 5);
+    CheckWriteUtf8(isolate, ascii, 3, "hel", 3, 3);
+    CheckWriteUtf8(isolate, ascii, 0, "", 0, 0);
+}
+
+static void TestWriteUtf8NoSplit() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+    v8::Context::Scope context_scope(context);
+
+    //"a" + U+00E9（2字节） + U+4E2D（3字节） + U+1F600（4字节，代理对）
+    const char* utf8 = "a\xc3\xa9\xe4\xb8\xad\xf0\x9f\x98\x80";
+    v8::Local<v8::String> str = TestString(isolate, utf8);
+    TEST_CHECK_EQ(str->Utf8Length(isolate), 10);
+    CheckWriteUtf8(isolate, str, -1, utf8, 10, 5, v8::String::NO_NULL_TERMINATION);
+    CheckWriteUtf8(isolate, str, 10, utf8, 10, 5);
+    CheckWriteUtf8(isolate, str, 9, utf8, 6, 3);
+    CheckWriteUtf8(isolate, str, 6, utf8, 6, 3);
+    CheckWriteUtf8(isolate, str, 5, utf8, 3, 2);
+    CheckWriteUtf8(isolate, str, 2, utf8, 1, 1);
+
+    //latin1字符串里的非ascii字符
+    v8::Local<v8::String> latin1 = TestString(isolate, "\xc3\xa9\xc3\xa9");
+    CheckWriteUtf8(isolate, latin1, 3, "\xc3\xa9", 2, 1);
+
+    //不带capacity的版本写出完整的字符串
+    char buffer[16];
+    memset(buffer, kGuard, sizeof(buffer));
+    TEST_CHECK_EQ(str->WriteUtf8(isolate, buffer), 10);
+    TEST_CHECK_EQ(std::string(buffer, 10), std::string(utf8));
+    TEST_CHECK_EQ(buffer[10], kGuard);
+}
+
+//在内存上限下调用new_string，应该返回空并且异常被TryCatch捕获
+template <typename F>
+static void CheckNewOutOfMemory(v8::Isolate* isolate, F new_string) {
+    v8::TryCatch try_catch(isolate);
+    JSMallocState malloc_state;
+    JS_GetMallocState(isolate->runtime_, &malloc_state);
+    JS_SetMemoryLimit(isolate->runtime_, malloc_state.malloc_size);
+    v8::MaybeLocal<v8::String> str = new_string();
+    JS_SetMemoryLimit(isolate->runtime_, (size_t)-1);
+    TEST_CHECK(str.IsEmpty());
+    TEST_CHECK(try_catch.HasCaught());
+}
+
+//分配失败时各个构造函数都返回空，异常交给TryCatch
+static void TestNewOutOfMemory() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+    v8::Context::Scope context_scope(context);
+
+    std::string data(4096, 'x');
+    std::u16string data16(4096, u'x');
+    v8::NewStringType types[] = { v8::NewStringType::kNormal, v8::NewStringType::kInternalized };
+    for (v8::NewStringType type : types) {
+        CheckNewOutOfMemory(isolate, [&]() {
+            return v8::String::NewFromUtf8(isolate, data.c_str(), type);
+        });
+        CheckNewOutOfMemory(isolate, [&]() {
+            return v8::String::NewFromOneByte(isolate, reinterpret_cast<const uint8_t*>(data.c_str()), type);
+        });
+        CheckNewOutOfMemory(isolate, [&]() {
+            return v8::String::NewFromTwoByte(isolate, reinterpret_cast<const uint16_t*>(data16.c_str()), type);
+        });
+    }
+    TEST_CHECK(!isolate->HasPendingException());
+
+    //length为0时是空字符串，-1时才按'\0'结尾计算长度
+    v8::Local<v8::String> empty = v8::String::NewFromUtf8(isolate, "abc", v8::NewStringType::kInternalized, 0).ToLocalChecked();
+    TEST_CHECK_EQ(empty->Length(), 0);
+    TEST_CHECK_EQ(v8::String::NewFromUtf8(isolate, "abc", v8::NewStringType::kNormal, -1).ToLocalChecked()->Length(), 3);
+}
+
+int main() {
+    TestPlatform platform;
+    RUN_TEST(TestWriteUtf8Bounds);
+    RUN_TEST(TestWriteUtf8NoSplit);
+    RUN_TEST(TestNewOutOfMemory);
+    return g_test_failures;
+}
@@ -0,0 +1,154 @@
+// FunctionTemplate / ObjectTemplate的行为测试
+
+#include "v8-test.h"
+
+static void Construct(const v8::FunctionCallbackInfo<v8::Value>& info) {
+}
+
+//分配失败时返回空，OOM异常交给TryCatch
+static void TestGetFunctionOutOfMemory() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+    v8::Context::Scope context_scope(context);
+
+    v8::Local<v8::FunctionTemplate> tmpl = v8::FunctionTemplate::New(isolate, Construct);
+    {
+        v8::TryCatch try_catch(isolate);
+        JSMallocState malloc_state;
+        JS_GetMallocState(isolate->runtime_, &malloc_state);
+        JS_SetMemoryLimit(isolate->runtime_, malloc_state.malloc_size);
+        v8::MaybeLocal<v8::Function> func = tmpl->GetFunction(context);
+        JS_SetMemoryLimit(isolate->runtime_, (size_t)-1);
+        TEST_CHECK(func.IsEmpty());
+        TEST_CHECK(try_catch.HasCaught());
+    }
+    TEST_CHECK(!tmpl->GetFunction(context).IsEmpty());
+}
+
+static void ReturnIndex(const v8::FunctionCallbackInfo<v8::Value>& info) {
+    info.GetReturnValue().Set(info.Data());
+}
+
+//属性数超过索引阈值后，同名属性仍然是覆盖而不是追加
+static void TestManyPropertiesOverwrite() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+    v8::Context::Scope context_scope(context);
+
+    const int kCount = 1000;
+    char name[32];
+    v8::Local<v8::FunctionTemplate> tmpl = v8::FunctionTemplate::New(isolate, Construct);
+    tmpl->InstanceTemplate()->SetInternalFieldCount(1);
+    v8::Local<v8::ObjectTemplate> proto = tmpl->PrototypeTemplate();
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < kCount; i++) {
+            snprintf(name, sizeof(name), "m%d", i);
+            proto->Set(isolate, name, v8::FunctionTemplate::New(isolate, ReturnIndex, v8::Integer::New(isolate, i + round * kCount)));
+        }
+    }
+    TEST_CHECK_EQ(proto->fields_.size(), (size_t)kCount);
+
+    context->Global()->Set(context, TestString(isolate, "Cls"), tmpl->GetFunction(context).ToLocalChecked()).Check();
+    v8::Local<v8::Value> result;
+    TEST_CHECK(TestRun(context, "var o = new Cls(); o.m0() + ',' + o.m999() + ',' + Object.getOwnPropertyNames(Cls.prototype).length").ToLocal(&result));
+    if (!result.IsEmpty()) {
+        TEST_CHECK_EQ(TestToString(isolate, result), "1000,1999,1001");
+    }
+}
+
+//返回data对象的value属性
+static void GetDataValue(v8::Local<v8::Name> property, const v8::PropertyCallbackInfo<v8::Value>& info) {
+    v8::Isolate* isolate = info.GetIsolate();
+    v8::Local<v8::Context> context = isolate->GetCurrentContext();
+    v8::Local<v8::Object> data = info.Data().As<v8::Object>();
+    info.GetReturnValue().Set(data->Get(context, TestString(isolate, "value")).ToLocalChecked());
+}
+
+static void GetName(v8::Local<v8::Name> property, const v8::PropertyCallbackInfo<v8::Value>& info) {
+    info.GetReturnValue().Set(property);
+}
+
+static v8::Local<v8::FunctionTemplate> NewAccessorTemplate(v8::Isolate* isolate, const char* value) {
+    v8::Local<v8::FunctionTemplate> tmpl = v8::FunctionTemplate::New(isolate, Construct);
+    tmpl->InstanceTemplate()->SetInternalFieldCount(1);
+    v8::Local<v8::Object> data = v8::Object::New(isolate);
+    data->Set(isolate->GetCurrentContext(), TestString(isolate, "value"), TestString(isolate, value)).Check();
+    tmpl->PrototypeTemplate()->SetAccessor(TestString(isolate, "prop"), GetDataValue, nullptr, data);
+    return tmpl;
+}
+
+//访问器的data只被模板和闭包引用，GC后仍然有效
+static void TestAccessorDataSurvivesGC() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+    v8::Context::Scope context_scope(context);
+
+    v8::Local<v8::FunctionTemplate> tmpl;
+    {
+        v8::EscapableHandleScope scope(isolate);
+        tmpl = NewAccessorTemplate(isolate, "alive");
+    }
+    isolate->LowMemoryNotification();
+    context->Global()->Set(context, TestString(isolate, "Cls"), tmpl->GetFunction(context).ToLocalChecked()).Check();
+    isolate->LowMemoryNotification();
+
+    v8::Local<v8::Value> result;
+    TEST_CHECK(TestRun(context, "new Cls().prop").ToLocal(&result));
+    if (!result.IsEmpty()) {
+        TEST_CHECK_EQ(TestToString(isolate, result), "alive");
+    }
+}
+
+//同名访问器重新注册后用新的回调，模板释放后不留下任何数据
+static void TestAccessorReregisterAndRelease() {
+    TestIsolate isolate;
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = v8::Context::New(isolate);
+    v8::Context::Scope context_scope(context);
+
+    {
+        v8::HandleScope scope(isolate);
+        v8::Local<v8::FunctionTemplate> tmpl = NewAccessorTemplate(isolate, "first");
+        context->Global()->Set(context, TestString(isolate, "First"), tmpl->GetFunction(context).ToLocalChecked()).Check();
+        tmpl->PrototypeTemplate()->SetAccessor(TestString(isolate, "prop"), GetName);
+        TEST_CHECK_EQ(tmpl->PrototypeTemplate()->accessor_infos_.size(), (size_t)1);
+    }
+
+    v8::Local<v8::Value> result;
+    TEST_CHECK(TestRun(context, "new First().prop").ToLocal(&result));
+    if (!result.IsEmpty()) {
+        TEST_CHECK_EQ(TestToString(isolate, result), "first");
+    }
+    TEST_CHECK(TestRun(context, "First = undefined").ToLocal(&result));
+
+    //反复创建、释放带访问器的模板，内存不增长
+    isolate->LowMemoryNotification();
+    JSMallocState before;
+    JS_GetMallocState(isolate->runtime_, &before);
+    for (int i = 0; i < 100; i++) {
+        v8::HandleScope scope(isolate);
+        v8::Local<v8::FunctionTemplate> tmpl = NewAccessorTemplate(isolate, "tmp");
+        v8::Local<v8::Object> obj = tmpl->GetFunction(context).ToLocalChecked()->NewInstance(context, 0, nullptr).ToLocalChecked();
+        TEST_CHECK_EQ(TestToString(isolate, obj->Get(context, TestString(isolate, "prop")).ToLocalChecked()), "tmp");
+    }
+    isolate->LowMemoryNotification();
+    JSMallocState after;
+    JS_GetMallocState(isolate->runtime_, &after);
+    TEST_CHECK(after.malloc_count <= before.malloc_count);
+}
+
+int main() {
+    TestPlatform platform;
+    RUN_TEST(TestGetFunctionOutOfMemory);
+    RUN_TEST(TestManyPropertiesOverwrite);
+    RUN_TEST(TestAccessorDataSurvivesGC);
+    RUN_TEST(TestAccessorReregisterAndRelease);
+    return g_test_failures;
+}
@@ -0,0 +1,292 @@
+// v8接口热点路径的benchmark，不做正确性检查（那是*-test.cc的事）
+// 用法：v8-bench [名字...]，不带参数时全部运行；建议Release构建下运行，
+// 对比不同实现时每个benchmark单独起一个进程，避免前一个benchmark留下的堆影响结果
+
+#include <chrono>
+#include <vector>
+
+#include "v8-test.h"
+
+typedef void (*BenchFunc)(v8::Isolate* isolate, v8::Local<v8::Context> context);
+
+struct Bench {
+    const char* name;
+    BenchFunc func;
+};
+
+static void Noop(const v8::FunctionCallbackInfo<v8::Value>& info) {
+    info.GetReturnValue().Set(info[0]);
+}
+
+static void Construct(const v8::FunctionCallbackInfo<v8::Value>& info) {
+}
+
+static void ThrowString(const v8::FunctionCallbackInfo<v8::Value>& info) {
+    v8::Isolate* isolate = info.GetIsolate();
+    isolate->ThrowException(TestString(isolate, "boom"));
+}
+
+//HandleScope内大量分配handle再整体释放
+static void BenchHandles(v8::Isolate* isolate, v8::Local<v8::Context> context) {
+    for (int round = 0; round < 1000; round++) {
+        v8::HandleScope scope(isolate);
+        for (int i = 0; i < 10000; i++) {
+            v8::Local<v8::Integer> v = v8::Integer::New(isolate, i);
+            (void)v;
+        }
+    }
+}
+
+//js调用c++函数（FunctionTemplate的trampoline）
+static void BenchCallback(v8::Isolate* isolate, v8::Local<v8::Context> context) {
+    TestSetFunction(context, "noop", Noop);
+    TestRun(context, "for (var i = 0; i < 3000000; i++) noop(i);");
+}
+
+//回调里按常见写法取当前isolate、进入Isolate::Scope和HandleScope
+static void CurrentIsolate(const v8::FunctionCallbackInfo<v8::Value>& info) {
+    v8::Isolate* isolate = v8::Isolate::GetCurrent();
+    v8::Isolate::Scope isolate_scope(isolate);
+    v8::HandleScope handle_scope(isolate);
+    info.GetReturnValue().Set(v8::Integer::New(isolate, info.Length()));
+}
+
+static void BenchCallbackScope(v8::Isolate* isolate, v8::Local<v8::Context> context) {
+    TestSetFunction(context, "current", CurrentIsolate);
+    TestRun(context, "for (var i = 0; i < 3000000; i++) current(i);");
+}
+
+//c++抛异常，js里catch
+static void BenchThrow(v8::Isolate* isolate, v8::Local<v8::Context> context) {
+    TestSetFunction(context, "throwString", ThrowString);
+    TestRun(context, "for (var i = 0; i < 300000; i++) { try { throwString(); } catch (e) {} }");
+}
+
+static void GetInternalValue(v8::Local<v8::Name> property, const v8::PropertyCallbackInfo<v8::Value>& info) {
+    info.GetReturnValue().Set(info.Data());
+}
+
+//ObjectTemplate::SetAccessor的getter
+static void BenchAccessor(v8::Isolate* isolate, v8::Local<v8::Context> context) {
+    v8::Local<v8::FunctionTemplate> tmpl = v8::FunctionTemplate::New(isolate, Construct);
+    tmpl->InstanceTemplate()->SetInternalFieldCount(1);
+    tmpl->PrototypeTemplate()->SetAccessor(TestString(isolate, "value"), GetInternalValue, nullptr, v8::Integer::New(isolate, 1));
+    context->Global()->Set(context, TestString(isolate, "Cls"), tmpl->GetFunction(context).ToLocalChecked()).Check();
+    TestRun(context, "var o = new Cls(); var s = 0; for (var i = 0; i < 3000000; i++) s += o.value;");
+}
+
+static void BenchGetFunction(v8::Isolate* isolate, v8::Local<v8::Context> context) {
+    v8::Local<v8::FunctionTemplate> tmpl = v8::FunctionTemplate::New(isolate, Noop);
+    for (int i = 0; i < 3000000; i++) {
+        v8::HandleScope scope(isolate);
+        v8::Local<v8::Function> func = tmpl->GetFunction(context).ToLocalChecked();
+        (void)func;
+    }
+}
+
+static void BenchHasInstance(v8::Isolate* isolate, v8::Local<v8::Context> context) {
+    v8::Local<v8::FunctionTemplate> base = v8::FunctionTemplate::New(isolate, Construct);
+    v8::Local<v8::FunctionTemplate> derived = v8::FunctionTemplate::New(isolate, Construct);
+    base->InstanceTemplate()->SetInternalFieldCount(1);
+    base->PrototypeTemplate()->Set(isolate, "base", v8::FunctionTemplate::New(isolate, Noop));
+    derived->InstanceTemplate()->SetInternalFieldCount(1);
+    derived->PrototypeTemplate()->Set(isolate, "derived", v8::FunctionTemplate::New(isolate, Noop));
+    derived->Inherit(base);
+    v8::Local<v8::Object> obj = derived->GetFunction(context).ToLocalChecked()->NewInstance(context, 0, nullptr).ToLocalChecked();
+    int hits = 0;
+    for (int i = 0; i < 10000000; i++) {
+        hits += base->HasInstance(obj) ? 1 : 0;
+    }
+    if (hits != 10000000) {
+        printf("has-instance: unexpected result %d\n", hits);
+    }
+}
+
+//属性较多的模板，每次新建模板并实例化
+static void BenchTemplateBuild(v8::Isolate* isolate, v8::Local<v8::Context> context) {
+    char name[32];
+    for (int round = 0; round < 2000; round++) {
+        v8::HandleScope scope(isolate);
+        v8::Local<v8::FunctionTemplate> tmpl = v8::FunctionTemplate::New(isolate, Construct);
+        tmpl->InstanceTemplate()->SetInternalFieldCount(1);
+        v8::Local<v8::ObjectTemplate> proto = tmpl->PrototypeTemplate();
+        for (int i = 0; i < 100; i++) {
+            snprintf(name, sizeof(name), "method%d", i);
+            proto->Set(isolate, name, v8::FunctionTemplate::New(isolate, Noop));
+        }
+        v8::Local<v8::Object> obj = tmpl->GetFunction(context).ToLocalChecked()->NewInstance(context, 0, nullptr).ToLocalChecked();
+        (void)obj;
+    }
+}
+
+static std::string MakeLargeSource() {
+    std::string source;
+    char line[128];
+    for (int i = 0; i < 2000; i++) {
+        snprintf(line, sizeof(line), "function f%d(a, b) { var s = 0; for (var i = a; i < b; i++) s += i * %d; return s; }\n", i, i);
+        source += line;
+    }
+    return source;
+}
+
+//从源码编译 vs 从code cache加载
+static void BenchCodeCache(v8::Isolate* isolate, v8::Local<v8::Context> context) {
+    std::string source = MakeLargeSource();
+    v8::Local<v8::String> source_string = TestString(isolate, source.c_str());
+
+    auto start = std::chrono::steady_clock::now();
+    v8::Local<v8::Script> script;
+    for (int i = 0; i < 50; i++) {
+        v8::ScriptCompiler::Source src(source_string);
+        script = v8::ScriptCompiler::Compile(context, &src).ToLocalChecked();
+    }
+    auto compiled = std::chrono::steady_clock::now();
+
+    std::unique_ptr<v8::ScriptCompiler::CachedData> cache(v8::ScriptCompiler::CreateCodeCache(script->GetUnboundScript()));
+    for (int i = 0; i < 50; i++) {
+        v8::ScriptCompiler::Source src(source_string, new v8::ScriptCompiler::CachedData(cache->data, cache->length));
+        v8::Local<v8::Script> cached = v8::ScriptCompiler::Compile(context, &src, v8::ScriptCompiler::kConsumeCodeCache).ToLocalChecked();
+        (void)cached;
+    }
+    auto consumed = std::chrono::steady_clock::now();
+
+    printf("  compile %.1f ms, consume cache %.1f ms (%d bytes)\n",
+        std::chrono::duration<double, std::milli>(compiled - start).count(),
+        std::chrono::duration<double, std::milli>(consumed - compiled).count(), cache->length);
+}
+
+//一次编译多次运行
+static void BenchScriptRun(v8::Isolate* isolate, v8::Local<v8::Context> context) {
+    v8::Local<v8::Script> script = v8::Script::Compile(context, TestString(isolate, "var x = (x || 0) + 1;")).ToLocalChecked();
+    for (int i = 0; i < 300000; i++) {
+        v8::HandleScope scope(isolate);
+        v8::Local<v8::Value> result = script->Run(context).ToLocalChecked();
+        (void)result;
+    }
+}
+
+static void BenchUtf8(v8::Isolate* isolate, v8::Local<v8::Context> context) {
+    v8::Local<v8::String> ascii = TestRun(context, "'abcdefghij'.repeat(100)").ToLocalChecked().As<v8::String>();
+    v8::Local<v8::String> wide = TestRun(context, "'abc\\u4e2d\\u6587def'.repeat(100)").ToLocalChecked().As<v8::String>();
+    std::vector<char> buffer(4096);
+    size_t total = 0;
+    for (int i = 0; i < 300000; i++) {
+        int len = ascii->Utf8Length(isolate);
+        total += ascii->WriteUtf8(isolate, buffer.data(), len);
+        len = wide->Utf8Length(isolate);
+        total += wide->WriteUtf8(isolate, buffer.data(), len);
+    }
+    if (total == 0) {
+        printf("utf8: nothing written\n");
+    }
+}
+
+//重复的属性名
+static void BenchInternalized(v8::Isolate* isolate, v8::Local<v8::Context> context) {
+    static const char* kNames[] = { "name", "value", "length", "position", "rotation", "scale", "enabled", "parent" };
+    v8::Local<v8::Object> obj = v8::Object::New(isolate);
+    for (int i = 0; i < 1000000; i++) {
+        v8::HandleScope scope(isolate);
+        v8::Local<v8::String> key = v8::String::NewFromUtf8(isolate, kNames[i % 8], v8::NewStringType::kInternalized).ToLocalChecked();
+        obj->Set(context, key, v8::Integer::New(isolate, i)).Check();
+    }
+}
+
+static void BenchArrayBuffer(v8::Isolate* isolate, v8::Local<v8::Context> context) {
+    for (int i = 0; i < 100000; i++) {
+        v8::HandleScope scope(isolate);
+        v8::Local<v8::ArrayBuffer> ab = v8::ArrayBuffer::New(isolate, 64 * 1024);
+        (void)ab;
+    }
+}
+
+static void BenchTypedArray(v8::Isolate* isolate, v8::Local<v8::Context> context) {
+    v8::Local<v8::ArrayBuffer> ab = v8::ArrayBuffer::New(isolate, 4096);
+    size_t total = 0;
+    for (int i = 0; i < 1000000; i++) {
+        v8::HandleScope scope(isolate);
+        v8::Local<v8::Uint8Array> view = v8::Uint8Array::New(ab, i % 64, 1024);
+        total += view->GetContents().ByteLength();
+    }
+    if (total == 0) {
+        printf("typed-array: empty views\n");
+    }
+}
+
+//同一块共享内存在两个isolate里建SharedArrayBuffer
+static void BenchSharedArrayBuffer(v8::Isolate* isolate, v8::Local<v8::Context> context) {
+    TestIsolate other;
+    v8::Local<v8::SharedArrayBuffer> sab = v8::SharedArrayBuffer::New(isolate, 4096);
+    std::shared_ptr<v8::BackingStore> store = sab->GetBackingStore();
+    {
+        v8::Isolate::Scope other_isolate_scope(other);
+        v8::HandleScope other_handle_scope(other);
+        v8::Local<v8::Context> other_context = v8::Context::New(other);
+        v8::Context::Scope other_context_scope(other_context);
+        for (int i = 0; i < 300000; i++) {
+            v8::HandleScope scope(other);
+            v8::Local<v8::SharedArrayBuffer> shared = v8::SharedArrayBuffer::New(other, store);
+            (void)shared;
+        }
+    }
+}
+
+//小对象、字符串密集的脚本，主要反映runtime的malloc（CreateParams::malloc_functions、JS_SLAB_ALLOCATOR）
+static void BenchAllocHeavy(v8::Isolate* isolate, v8::Local<v8::Context> context) {
+    TestRun(context,
+        "var keep = [];"
+        "for (var i = 0; i < 2000000; i++) {"
+        "  var o = { a: i, b: 'k' + (i & 1023), c: [i, i + 1] };"
+        "  if ((i & 255) == 0) keep.push(o);"
+        "}");
+}
+
+static const Bench kBenches[] = {
+    { "handles", BenchHandles },
+    { "callback", BenchCallback },
+    { "callback-scope", BenchCallbackScope },
+    { "throw", BenchThrow },
+    { "accessor", BenchAccessor },
+    { "get-function", BenchGetFunction },
+    { "has-instance", BenchHasInstance },
+    { "template-build", BenchTemplateBuild },
+    { "code-cache", BenchCodeCache },
+    { "script-run", BenchScriptRun },
+    { "utf8", BenchUtf8 },
+    { "internalized", BenchInternalized },
+    { "array-buffer", BenchArrayBuffer },
+    { "typed-array", BenchTypedArray },
+    { "shared-array-buffer", BenchSharedArrayBuffer },
+    { "alloc-heavy", BenchAllocHeavy },
+};
+
+static void RunBench(const Bench& bench) {
+    TestIsolate isolate;
+    {
+        v8::Isolate::Scope isolate_scope(isolate);
+        v8::HandleScope handle_scope(isolate);
+        v8::Local<v8::Context> context = v8::Context::New(isolate);
+        v8::Context::Scope context_scope(context);
+
+        auto start = std::chrono::steady_clock::now();
+        bench.func(isolate, context);
+        auto end = std::chrono::steady_clock::now();
+        printf("%-20s %8.1f ms\n", bench.name, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+}
+
+int main(int argc, char* argv[]) {
+    TestPlatform platform;
+    for (const Bench& bench : kBenches) {
+        bool selected = argc <= 1;
+        for (int i = 1; i < argc; i++) {
+            if (strcmp(argv[i], bench.name) == 0) {
+                selected = true;
+            }
+        }
+        if (selected) {
+            RunBench(bench);
+        }
+    }
+    return 0;
+}
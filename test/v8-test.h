@@ -0,0 +1,107 @@
+// test下各个测试共用的小工具：每个测试是一个独立的可执行文件，
+// 用TEST_CHECK记录失败，main里RUN_TEST逐个执行，最后返回失败个数
+
+#ifndef V8_TEST_H_
+#define V8_TEST_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <memory>
+#include <string>
+
+#include "libplatform/libplatform.h"
+#include "v8.h"
+
+static int g_test_failures = 0;
+
+#define TEST_CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            ++g_test_failures; \
+        } \
+    } while (0)
+
+#define TEST_CHECK_EQ(a, b) TEST_CHECK((a) == (b))
+
+#define RUN_TEST(fn) \
+    do { \
+        int failures_before = g_test_failures; \
+        fn(); \
+        printf("%s %s\n", g_test_failures == failures_before ? "[ OK ]" : "[FAIL]", #fn); \
+    } while (0)
+
+class TestPlatform {
+public:
+    TestPlatform() : platform_(v8::platform::NewDefaultPlatform()) {
+        v8::V8::InitializePlatform(platform_.get());
+        v8::V8::Initialize();
+    }
+
+    ~TestPlatform() {
+        v8::V8::Dispose();
+        v8::V8::ShutdownPlatform();
+    }
+
+private:
+    std::unique_ptr<v8::Platform> platform_;
+};
+
+//一个isolate加上它的ArrayBuffer::Allocator（所有权交给TestIsolate）
+class TestIsolate {
+public:
+    explicit TestIsolate(v8::ArrayBuffer::Allocator* allocator = v8::ArrayBuffer::Allocator::NewDefaultAllocator())
+        : allocator_(allocator) {
+        v8::Isolate::CreateParams params;
+        params.array_buffer_allocator = allocator_;
+        isolate_ = v8::Isolate::New(params);
+    }
+
+    ~TestIsolate() {
+        Dispose();
+        delete allocator_;
+    }
+
+    //测试需要在Isolate销毁后做检查时可以提前调用
+    void Dispose() {
+        if (isolate_) {
+            isolate_->Dispose();
+            isolate_ = nullptr;
+        }
+    }
+
+    v8::Isolate* operator->() const { return isolate_; }
+
+    operator v8::Isolate*() const { return isolate_; }
+
+private:
+    v8::Isolate* isolate_;
+
+    v8::ArrayBuffer::Allocator* allocator_;
+};
+
+static inline v8::Local<v8::String> TestString(v8::Isolate* isolate, const char* str) {
+    return v8::String::NewFromUtf8(isolate, str).ToLocalChecked();
+}
+
+//编译并执行，出错（包括异常）时返回空
+static inline v8::MaybeLocal<v8::Value> TestRun(v8::Local<v8::Context> context, const char* source) {
+    v8::Isolate* isolate = context->GetIsolate();
+    v8::Local<v8::Script> script;
+    if (!v8::Script::Compile(context, TestString(isolate, source)).ToLocal(&script)) {
+        return v8::MaybeLocal<v8::Value>();
+    }
+    return script->Run(context);
+}
+
+static inline std::string TestToString(v8::Isolate* isolate, v8::Local<v8::Value> value) {
+    return *v8::String::Utf8Value(isolate, value);
+}
+
+static inline void TestSetFunction(v8::Local<v8::Context> context, const char* name, v8::FunctionCallback callback) {
+    v8::Isolate* isolate = context->GetIsolate();
+    v8::Local<v8::Function> func = v8::FunctionTemplate::New(isolate, callback)->GetFunction(context).ToLocalChecked();
+    context->Global()->Set(context, TestString(isolate, name), func).Check();
+}
+
+#endif  // V8_TEST_H_